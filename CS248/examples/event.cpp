@@ -49,12 +49,14 @@ class EventDisply : public Renderer {
   void cursor_event(float x, float y) {
     if (left_down) {
       text_mgr.set_anchor(line0, 2 * (x - .5 * w) / w, 2 * (.5 * h - y) / h);      
+      invalidate();
     }
   }
 
   void scroll_event(float offset_x, float offset_y) {
     size += int(offset_y + offset_x);
     text_mgr.set_size(line0, size);
+    invalidate();
   }
 
   void mouse_event(int key, int event, unsigned char mods) {
@@ -87,6 +89,7 @@ class EventDisply : public Renderer {
     }
 
     text_mgr.set_text(line0, s);
+    invalidate();
   }
 
  private:
@@ -125,6 +125,7 @@ class Template : public Renderer {
     float anchor_x = 2 * (x + 10 - .5 * w) / w;
     float anchor_y = 2 * (.5 * h - y + 10) / h;
     text_mgr.set_anchor(line0, anchor_x, anchor_y);
+    invalidate();
   }
 
   void scroll_event(float offset_x, float offset_y) {
@@ -132,6 +133,7 @@ class Template : public Renderer {
     camera.dir = -Vector3D(sin(camera.phi),cos(camera.theta),cos(camera.phi)).unit();
     camera.up = cross(camera.dir,cross(Vector3D(0,1,0), camera.dir)).unit();
     camera.pos = -camera.dir * camera.r;
+    invalidate();
   }
 
   void mouse_event(int key, int event, unsigned char mods) {
@@ -164,6 +166,7 @@ class Template : public Renderer {
     }
 
     text_mgr.set_text(line0, s);
+    invalidate();
   }
 
  private:
@@ -48,11 +48,13 @@ class TextDrawer : public Renderer {
 
   void cursor_event(float x, float y) {
     text_mgr.set_anchor(line0, 2 * (x - .5 * w) / w, 2 * (.5 * h - y) / h);      
+    invalidate();
   }
 
   void scroll_event(float offset_x, float offset_y) {
     size += int(offset_y + offset_x);
     text_mgr.set_size(line0, size);
+    invalidate();
   }
 
 
@@ -44,7 +44,7 @@ class TriangleDrawer : public Renderer {
   }
 
   void keyboard_event(int key, int event, unsigned char mods) {
-    if (key == 'R') shoud_draw = !shoud_draw; 
+    if (key == 'R') { shoud_draw = !shoud_draw; invalidate(); }
     return;
   }
   
@@ -1,4 +1,12 @@
 #include <string>
 
 std::string base64_encode(unsigned char const* , unsigned int len);
-std::string base64_decode(std::string const& s);
\ No newline at end of file
+std::string base64_decode(std::string const& s);
+
+// upper bound on the number of bytes decoded from len input characters
+inline size_t base64_decoded_size(size_t len) { return len / 4 * 3 + 3; }
+
+// decode into out, which must hold base64_decoded_size(len) bytes.
+// whitespace is skipped, decoding stops at padding or any other character.
+// returns the number of bytes written.
+size_t base64_decode(const char* in, size_t len, unsigned char* out);
\ No newline at end of file
@@ -5,6 +5,7 @@
 
 #include <stdio.h>
 #include <string>
+#include <atomic>
 
 namespace CS248 {
 
@@ -133,9 +134,32 @@ class Renderer {
    */
   void use_hdpi_reneder_target() { use_hdpi = true; }
 
+  /**
+   * Request a new frame.
+   * The viewer sleeps until something changes and only calls render() and
+   * info() after an invalidation. Renderers should call this whenever their
+   * output or their info text changes. This may be called from any thread,
+   * a renderer drawing on its own thread also has to wake up the viewer
+   * with glfwPostEmptyEvent.
+   */
+  void invalidate() { dirty = true; }
+
+  /**
+   * Internal -
+   * The viewer checks and clears pending redraw requests on every update.
+   */
+  bool needs_redraw() { return dirty.exchange(false); }
+
+  /**
+   * Internal -
+   * Check for a pending redraw request without clearing it.
+   */
+  bool redraw_pending() const { return dirty; }
+
  protected:
 
   bool use_hdpi; ///< if the render target is using HIDPI
+  std::atomic<bool> dirty { true }; ///< if the renderer requested a new frame
 
 };
 
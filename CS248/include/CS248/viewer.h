@@ -63,6 +63,8 @@ class Viewer {
 
   /**
    * Main update loop.
+   * Draws a frame only when the viewer or the renderer was invalidated and
+   * otherwise blocks waiting for window events.
    */
   static void update( void );
 
@@ -76,6 +78,7 @@ class Viewer {
   static void key_callback( GLFWwindow* window, int key, int scancode, int action, int mods );
   static void char_callback( GLFWwindow* window, unsigned int codepoint );
   static void resize_callback( GLFWwindow* window, int width, int height );
+  static void refresh_callback( GLFWwindow* window );
   static void cursor_callback( GLFWwindow* window, double xpos, double ypos );
   static void scroll_callback( GLFWwindow* window, double xoffset, double yoffset);
   static void mouse_button_callback( GLFWwindow* window, int button, int action, int mods );
@@ -91,6 +94,9 @@ class Viewer {
   // info toggle
   static bool showInfo;
 
+  // set when the viewer itself needs a new frame
+  static bool dirty;
+
   // window properties
   static GLFWwindow* window;
   static size_t buffer_w;
@@ -121,3 +121,64 @@ std::string base64_decode(std::string const& encoded_string) {
 
   return ret;
 }
+
+// maps characters to their 6 bit values, whitespace to kSkip and
+// everything else (including padding) to kStop
+static const unsigned char kSkip = 0x40;
+static const unsigned char kStop = 0x80;
+
+struct base64_table {
+  unsigned char value[256];
+  base64_table() {
+    for (int c = 0; c < 256; c++) value[c] = kStop;
+    for (int i = 0; i < 64; i++) value[(unsigned char) base64_chars[i]] = i;
+    value[' '] = value['\t'] = value['\n'] = value['\r'] = kSkip;
+  }
+};
+
+static const base64_table base64_lookup;
+
+size_t base64_decode(const char* in, size_t len, unsigned char* out) {
+  const unsigned char* p = (const unsigned char*) in;
+  const unsigned char* end = p + len;
+  const unsigned char* table = base64_lookup.value;
+  unsigned char* o = out;
+
+  unsigned int quad = 0;
+  int n = 0;
+  while (p < end) {
+
+    // fast path: four plain characters in a row
+    if (n == 0 && end - p >= 4) {
+      unsigned char a = table[p[0]], b = table[p[1]];
+      unsigned char c = table[p[2]], d = table[p[3]];
+      if (((a | b | c | d) & (kSkip | kStop)) == 0) {
+        unsigned int v = (a << 18) | (b << 12) | (c << 6) | d;
+        o[0] = v >> 16; o[1] = v >> 8; o[2] = v;
+        o += 3; p += 4;
+        continue;
+      }
+    }
+
+    unsigned char v = table[*p++];
+    if (v & kSkip) continue;
+    if (v & kStop) break;
+
+    quad = (quad << 6) | v;
+    if (++n == 4) {
+      o[0] = quad >> 16; o[1] = quad >> 8; o[2] = quad;
+      o += 3; quad = 0; n = 0;
+    }
+  }
+
+  // trailing partial group
+  if (n == 2) {
+    o[0] = quad >> 4;
+    o += 1;
+  } else if (n == 3) {
+    o[0] = quad >> 10; o[1] = quad >> 2;
+    o += 2;
+  }
+
+  return o - out;
+}
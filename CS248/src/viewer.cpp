@@ -29,6 +29,9 @@ time_point<system_clock> Viewer::sys_curr;
 // draw toggles
 bool Viewer::showInfo = true;
 
+// redraw request from the viewer itself
+bool Viewer::dirty = true;
+
 // window properties
 GLFWwindow* Viewer::window;
 size_t Viewer::buffer_w;
@@ -48,12 +51,13 @@ Viewer::Viewer() {
 
 Viewer::~Viewer() {
 
-  glfwDestroyWindow(window);
-  glfwTerminate();
-  
-  // free resources
+  // free resources while the context is still around, renderers may
+  // also still be posting events from their own threads
   delete renderer;
   delete osd_text;
+
+  glfwDestroyWindow(window);
+  glfwTerminate();
 }
 
 
@@ -81,6 +85,7 @@ void Viewer::init() {
 
   // framebuffer event callbacks
   glfwSetFramebufferSizeCallback( window, resize_callback );
+  glfwSetWindowRefreshCallback( window, refresh_callback );
   
   // key event callbacks
   glfwSetKeyCallback( window, key_callback );
@@ -153,56 +158,63 @@ void Viewer::set_renderer(Renderer *renderer) {
 }
 
 void Viewer::update() {
-  
-  // clear frame
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-  // run user renderer
-  if (renderer) {
-    renderer->render();
-  }
+  // only draw a frame if the viewer or the renderer changed something
+  bool redraw = dirty; dirty = false;
+  if (renderer && renderer->needs_redraw()) redraw = true;
 
-  // draw info
-  if( showInfo ) {
-    drawInfo();        
-  } 
+  if (redraw) {
+
+    // clear frame
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    // run user renderer
+    if (renderer) {
+      renderer->render();
+    }
 
-  // swap buffers
-  glfwSwapBuffers(window); 
+    // draw info
+    if( showInfo ) {
+      drawInfo();
+    }
 
-  // poll events
-  glfwPollEvents();
+    // swap buffers
+    glfwSwapBuffers(window);
+  }
+
+  // keep going while another frame is pending, e.g. a renderer refining
+  // its output, otherwise sleep until the next event
+  if (dirty || (renderer && renderer->redraw_pending())) {
+    glfwPollEvents();
+  } else {
+    glfwWaitEvents();
+  }
 }
 
 
 void Viewer::drawInfo() {
 
-  // compute timers - fps is update every second
+  // compute timers - fps is update every second. frames are only drawn
+  // on changes, so this is the rate of frames actually drawn since the
+  // last update, which drops to zero while idle
+  framecount++;
   sys_curr = system_clock::now();
   double elapsed = ((duration<double>) (sys_curr - sys_last)).count();
   if (elapsed >= 1.0f) {
 
     // update framecount OSD
-    Color c = framecount < 20 ? Color(1.0, 0.35, 0.35) : Color(0.15, 0.5, 0.15);
+    int fps = (int) (framecount / elapsed + 0.5);
+    Color c = fps < 20 ? Color(1.0, 0.35, 0.35) : Color(0.15, 0.5, 0.15);
     osd_text->set_color(line_id_framerate, c);
-    string framerate_info = "Framerate: " + to_string(framecount) + " fps";
+    string framerate_info = "Framerate: " + to_string(fps) + " fps";
     osd_text->set_text(line_id_framerate, framerate_info);
 
     // reset timer and counter
     framecount = 0;
-    sys_last = sys_curr; 
-
-  } else {
-
-    // increment framecount
-    framecount++;
-  
+    sys_last = sys_curr;
   }
 
-  // udpate renderer OSD
-  // TODO: This is done on every update and it shouldn't be!
-  // The viewer should only update when the renderer needs to
-  // update the info text. 
+  // udpate renderer OSD, this only runs when a frame is drawn
   if (renderer) {
     string renderer_info = renderer->info();
     osd_text->set_text(line_id_renderer, renderer_info);
@@ -235,6 +247,14 @@ void Viewer::resize_callback( GLFWwindow* window, int width, int height ) {
 
   // resize render if there is a user space renderer
   if (renderer) renderer->resize( buffer_w, buffer_h );  
+
+  dirty = true;
+}
+
+void Viewer::refresh_callback( GLFWwindow* window ) {
+
+  // window contents were damaged, e.g. uncovered by another window
+  dirty = true;
 }
 
 void Viewer::cursor_callback( GLFWwindow* window, double xpos, double ypos ) {
@@ -273,6 +293,7 @@ void Viewer::key_callback( GLFWwindow* window,
       glfwSetWindowShouldClose( window, true ); 
     } else if( key == GLFW_KEY_GRAVE_ACCENT ){
       showInfo = !showInfo;
+      dirty = true;
     } 
   }
   
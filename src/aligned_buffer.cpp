@@ -0,0 +1,66 @@
+#include "aligned_buffer.h"
+
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace CS248 {
+
+// blocks this large are aligned to huge pages, which the kernel may then
+// back them with
+static const size_t kHugePage = 2 << 20;
+
+static unsigned char* allocate( size_t size ) {
+
+  void* p = NULL;
+#ifdef _WIN32
+  p = _aligned_malloc(size, AlignedBuffer::kAlignment);
+#else
+  size_t alignment = size >= kHugePage ? kHugePage : AlignedBuffer::kAlignment;
+  if (posix_memalign(&p, alignment, size)) p = NULL;
+#ifdef MADV_HUGEPAGE
+  if (p && size >= kHugePage) madvise(p, size, MADV_HUGEPAGE);
+#endif
+#endif
+  if (!p) throw std::bad_alloc();
+  return (unsigned char*) p;
+}
+
+unsigned char* AlignedBuffer::reserve( size_t size ) {
+
+  if (!size) {
+    release();
+    return NULL;
+  }
+
+  // keep the block while it fits and is not mostly unused
+  if (size <= capacity && size >= capacity / 4) return bytes;
+
+  // grow with half again as much room, shrink to fit
+  size_t grown = size > capacity ? capacity + capacity / 2 : 0;
+  size_t fitted = size > grown ? size : grown;
+  fitted = (fitted + kAlignment - 1) / kAlignment * kAlignment;
+
+  release();
+  bytes = allocate(fitted);
+  capacity = fitted;
+  return bytes;
+}
+
+void AlignedBuffer::release() {
+
+#ifdef _WIN32
+  _aligned_free(bytes);
+#else
+  free(bytes);
+#endif
+  bytes = NULL;
+  capacity = 0;
+}
+
+} // namespace CS248
@@ -0,0 +1,38 @@
+#ifndef CS248_ALIGNED_BUFFER_H
+#define CS248_ALIGNED_BUFFER_H
+
+#include <stddef.h>
+
+namespace CS248 {
+
+// A block of memory aligned to cache lines that keeps its capacity across
+// resizes. Growing by a little, as a window being resized does, reuses the
+// block or grows it with room to spare, and shrinking keeps it until far
+// less is needed. The contents are left undefined whenever the size
+// changes, so nothing is copied or cleared that is about to be drawn over.
+class AlignedBuffer {
+ public:
+
+  static const size_t kAlignment = 64;
+
+  AlignedBuffer() : bytes(NULL), capacity(0) { }
+  ~AlignedBuffer() { release(); }
+
+  // a block of at least size bytes, NULL for none
+  unsigned char* reserve( size_t size );
+
+  // free the block
+  void release();
+
+ private:
+
+  unsigned char* bytes;
+  size_t capacity;
+
+  AlignedBuffer( const AlignedBuffer& );
+  AlignedBuffer& operator=( const AlignedBuffer& );
+};
+
+} // namespace CS248
+
+#endif // CS248_ALIGNED_BUFFER_H
@@ -0,0 +1,302 @@
+#include "CS248.h"
+#include "timer.h"
+#include "svg.h"
+#include "texture.h"
+#include "viewport.h"
+#include "software_renderer.h"
+#include "corpus.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+using namespace std;
+using namespace CS248;
+
+#define msg(s) cerr << "[Bench] " << s << endl;
+
+// Times every svg file under the given paths: parsing, mipmap generation,
+// and drawing with the implementation at each frame size and sample rate,
+// with the drawing broken down into the stages of StageTimes. Every
+// measurement is repeated and reported as its median and 99th percentile,
+// as text and optionally as JSON.
+
+// stages of a drawing as reported, in milliseconds
+static const char* kStages[] = {
+  "total", "clear", "transform", "triangulate", "rasterize", "resolve"
+};
+static const size_t kNumStages = sizeof(kStages) / sizeof(kStages[0]);
+
+struct Summary {
+  double median, p99;
+};
+
+// nearest rank percentiles of a set of timings
+static Summary summarize( vector<double> times ) {
+
+  Summary s = { 0, 0 };
+  if (times.empty()) return s;
+
+  sort(times.begin(), times.end());
+  size_t n = times.size();
+  s.median = n % 2 ? times[n / 2] : (times[n / 2 - 1] + times[n / 2]) / 2;
+  s.p99 = times[(size_t) ceil(0.99 * n) - 1];
+  return s;
+}
+
+struct Case {
+  size_t width, height, sample_rate;
+  Summary stages[kNumStages];
+};
+
+struct FileResult {
+  string name;
+  size_t elements;
+  Summary parse, mipmap;
+  vector<Case> cases;
+};
+
+static void usage() {
+  msg("Usage: drawsvg-bench [options] <svg file or directory> ...");
+  msg("  -s <w>x<h>,...  frame sizes (default 400x300,1024x768)");
+  msg("  -r <rates>      comma separated sample rates (default 1,2,4)");
+  msg("  -n <count>      runs per measurement (default 10)");
+  msg("  -o              draw with occlusion culling");
+  msg("  -l              blend and resolve in linear light");
+  msg("  -c              keep samples as coverage fragments");
+  msg("  -a              anti-alias fills by their exact coverage");
+  msg("  -j <file>       also write the results as JSON, - for stdout");
+}
+
+static size_t count_elements( const vector<SVGElement*>& elements ) {
+
+  size_t n = elements.size();
+  for (size_t i = 0; i < elements.size(); i++) {
+    if (elements[i]->type == GROUP) {
+      n += count_elements(static_cast<Group*>(elements[i])->elements);
+    }
+  }
+  return n;
+}
+
+// a string as a json literal
+static string json_string( const string& s ) {
+
+  string quoted = "\"";
+  for (size_t i = 0; i < s.size(); i++) {
+    if (s[i] == '"' || s[i] == '\\') quoted.push_back('\\');
+    quoted.push_back(s[i]);
+  }
+  return quoted + "\"";
+}
+
+static void write_summary( ostream& out, const char* name, const Summary& s ) {
+  out << "\"" << name << "\": { \"median\": " << s.median
+      << ", \"p99\": " << s.p99 << " }";
+}
+
+static void write_json( ostream& out, const vector<FileResult>& results, int runs ) {
+
+  out << "{\n  \"unit\": \"ms\",\n  \"runs\": " << runs << ",\n  \"files\": [";
+  for (size_t f = 0; f < results.size(); f++) {
+    const FileResult& r = results[f];
+    out << (f ? "," : "") << "\n    {\n"
+        << "      \"file\": " << json_string(r.name) << ",\n"
+        << "      \"elements\": " << r.elements << ",\n      ";
+    write_summary(out, "parse", r.parse);
+    out << ",\n      ";
+    write_summary(out, "mipmap", r.mipmap);
+    out << ",\n      \"renders\": [";
+    for (size_t c = 0; c < r.cases.size(); c++) {
+      const Case& k = r.cases[c];
+      out << (c ? "," : "") << "\n        { \"width\": " << k.width
+          << ", \"height\": " << k.height
+          << ", \"sample_rate\": " << k.sample_rate;
+      for (size_t s = 0; s < kNumStages; s++) {
+        out << ",\n          ";
+        write_summary(out, kStages[s], k.stages[s]);
+      }
+      out << " }";
+    }
+    out << "\n      ]\n    }";
+  }
+  out << "\n  ]\n}\n";
+}
+
+int main( int argc, char** argv ) {
+
+  vector<string> paths;
+  string sizes = "400x300,1024x768", rates = "1,2,4", json;
+  int runs = 10;
+  bool occlusion_culling = false, linear_light = false, compressed = false,
+       analytic = false;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "-s" && has_value) sizes = argv[++i];
+    else if (arg == "-r" && has_value) rates = argv[++i];
+    else if (arg == "-n" && has_value) runs = max(1, atoi(argv[++i]));
+    else if (arg == "-j" && has_value) json = argv[++i];
+    else if (arg == "-o") occlusion_culling = true;
+    else if (arg == "-l") linear_light = true;
+    else if (arg == "-c") compressed = true;
+    else if (arg == "-a") analytic = true;
+    else if (arg[0] == '-') { usage(); return 1; }
+    else paths.push_back(arg);
+  }
+
+  vector< pair<size_t, size_t> > frame_sizes;
+  istringstream size_list(sizes);
+  for (string size; getline(size_list, size, ','); ) {
+    size_t w, h;
+    if (sscanf(size.c_str(), "%zux%zu", &w, &h) == 2 && w && h) {
+      frame_sizes.push_back(make_pair(w, h));
+    }
+  }
+
+  vector<size_t> sample_rates;
+  istringstream rate_list(rates);
+  for (string rate; getline(rate_list, rate, ','); ) {
+    if (atoi(rate.c_str()) > 0) sample_rates.push_back(atoi(rate.c_str()));
+  }
+
+  if (paths.empty() || frame_sizes.empty() || sample_rates.empty()) {
+    usage(); return 1;
+  }
+
+  SoftwareRendererImp renderer;
+  Sampler2DImp sampler;
+  renderer.set_tex_sampler(&sampler);
+  renderer.set_occlusion_culling(occlusion_culling);
+  renderer.set_linear_light(linear_light);
+  renderer.set_compressed_samples(compressed);
+  renderer.set_analytic_coverage(analytic);
+
+  vector<FileResult> results;
+  for (size_t p = 0; p < paths.size(); p++) {
+
+    vector<string> files;
+    find_svg_files(paths[p], files);
+
+    for (size_t f = 0; f < files.size(); f++) {
+
+      FileResult result;
+      result.name = files[f];
+
+      // parse from scratch each run, keeping the last one to draw
+      vector<double> parse_times;
+      SVG* svg = NULL;
+      for (int run = 0; run < runs; run++) {
+        delete svg;
+        svg = new SVG();
+        Timer timer;
+        timer.start();
+        int status = SVGParser::load(files[f].c_str(), svg);
+        timer.stop();
+        if (status < 0) break;
+        parse_times.push_back(timer.duration() * 1000);
+      }
+
+      if (parse_times.size() < (size_t) runs) {
+        msg("Could not load " << files[f]);
+        delete svg;
+        continue;
+      }
+
+      result.parse = summarize(parse_times);
+      result.elements = count_elements(svg->elements);
+
+      // images are decoded once, only their mipmaps are timed
+      decode_textures(svg->elements);
+      vector<double> mip_times;
+      for (int run = 0; run < runs; run++) {
+        Timer timer;
+        timer.start();
+        generate_mipmaps(svg->elements, &sampler);
+        timer.stop();
+        mip_times.push_back(timer.duration() * 1000);
+      }
+      result.mipmap = summarize(mip_times);
+
+      for (size_t s = 0; s < frame_sizes.size(); s++) {
+
+        size_t w = frame_sizes[s].first, h = frame_sizes[s].second;
+        vector<unsigned char> pixels(4 * w * h);
+        renderer.set_pixel_buffer(&pixels[0], w, h);
+
+        ViewportImp viewport;
+        renderer.set_canvas_to_screen(view_transform(viewport, *svg, 0.5f, 0.5f, 1, w, h));
+
+        for (size_t r = 0; r < sample_rates.size(); r++) {
+
+          renderer.set_sample_rate(sample_rates[r]);
+
+          vector<double> times[kNumStages];
+          for (int run = 0; run < runs; run++) {
+
+            StageTimes stages = { 0, 0, 0, 0, 0 };
+            renderer.set_stage_times(&stages);
+
+            Timer timer;
+            timer.start();
+            renderer.clear_buffer();
+            renderer.draw_svg(*svg);
+            timer.stop();
+
+            renderer.set_stage_times(NULL);
+
+            double transform = stages.draw - stages.triangulate - stages.rasterize;
+            double measured[kNumStages] = {
+              timer.duration(), stages.clear, max(transform, 0.0),
+              stages.triangulate, stages.rasterize, stages.resolve
+            };
+            for (size_t k = 0; k < kNumStages; k++) {
+              times[k].push_back(measured[k] * 1000);
+            }
+          }
+
+          Case c;
+          c.width = w; c.height = h; c.sample_rate = sample_rates[r];
+          for (size_t k = 0; k < kNumStages; k++) c.stages[k] = summarize(times[k]);
+          result.cases.push_back(c);
+
+          printf("%-44s %4zux%-4zu sr=%zu  total %8.2f ms (p99 %8.2f)  "
+                 "clear %6.2f  transform %6.2f  triangulate %6.2f  "
+                 "rasterize %8.2f  resolve %6.2f\n",
+                 files[f].c_str(), w, h, sample_rates[r],
+                 c.stages[0].median, c.stages[0].p99, c.stages[1].median,
+                 c.stages[2].median, c.stages[3].median, c.stages[4].median,
+                 c.stages[5].median);
+          fflush(stdout);
+        }
+      }
+
+      printf("%-44s %zu elements  parse %8.2f ms (p99 %8.2f)  mipmap %8.2f ms (p99 %8.2f)\n",
+             files[f].c_str(), result.elements, result.parse.median,
+             result.parse.p99, result.mipmap.median, result.mipmap.p99);
+      fflush(stdout);
+
+      results.push_back(result);
+      delete svg;
+    }
+  }
+
+  if (json == "-") {
+    write_json(cout, results, runs);
+  } else if (!json.empty()) {
+    ofstream out(json.c_str());
+    if (!out) {
+      msg("Could not write " << json);
+      return 1;
+    }
+    write_json(out, results, runs);
+  }
+
+  return 0;
+}
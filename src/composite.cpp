@@ -0,0 +1,294 @@
+#include "composite.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace CS248 {
+
+uint16_t srgb_decode[256];
+uint8_t srgb_encode[4096];
+
+// fills the sRGB tables before main
+static struct SRGBTables {
+  SRGBTables() {
+    for (int i = 0; i < 256; i++) {
+      double c = i / 255.0;
+      double linear = c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+      srgb_decode[i] = (uint16_t) (linear * 65535 + 0.5);
+    }
+
+    // each 12 bit step encodes to the value whose decoding is nearest the
+    // middle of the step. decoded values are more than 16 apart, so that
+    // is the value itself for steps holding one
+    int code = 0;
+    for (int i = 0; i < 4096; i++) {
+      int middle = 16 * i + 8;
+      while (code < 255 &&
+             std::abs(srgb_decode[code + 1] - middle) <= std::abs(srgb_decode[code] - middle)) {
+        code++;
+      }
+      srgb_encode[i] = (uint8_t) code;
+    }
+  }
+} srgb_tables;
+
+#ifdef __SSE2__
+// blend_over on the four channels of one sample, widened to 32 bit lanes
+static inline __m128i blend_lanes( __m128i d, __m128 inv, __m128 rgb,
+                                   __m128 alpha_lane ) {
+  const __m128 one = _mm_set1_ps(1);
+  const __m128 inv255 = _mm_set1_ps(1.0f / 255);
+
+  // dst * (1 - a) for color, (1 - dst) * (1 - a) for alpha
+  __m128 v = _mm_mul_ps(_mm_cvtepi32_ps(d), inv255);
+  v = _mm_or_ps(_mm_andnot_ps(alpha_lane, v),
+                _mm_and_ps(alpha_lane, _mm_sub_ps(one, v)));
+  v = _mm_mul_ps(inv, v);
+
+  // plus the source for color, one minus that for alpha
+  v = _mm_or_ps(_mm_andnot_ps(alpha_lane, _mm_add_ps(v, rgb)),
+                _mm_and_ps(alpha_lane, _mm_sub_ps(one, v)));
+  return _mm_cvttps_epi32(_mm_mul_ps(v, _mm_set1_ps(255)));
+}
+#endif
+
+void blend_span( unsigned char* dst, size_t n, const Premultiplied& src ) {
+
+  size_t i = 0;
+
+#ifdef __SSE2__
+  const __m128i zero = _mm_setzero_si128();
+  const __m128 inv = _mm_set1_ps(src.inv);
+  const __m128 rgb = _mm_setr_ps(src.rgb[0], src.rgb[1], src.rgb[2], 0);
+  const __m128 alpha_lane = _mm_castsi128_ps(_mm_setr_epi32(0, 0, 0, -1));
+
+  for (; i + 4 <= n; i += 4) {
+    __m128i d = _mm_loadu_si128((const __m128i*) (dst + 4 * i));
+    __m128i lo = _mm_unpacklo_epi8(d, zero);
+    __m128i hi = _mm_unpackhi_epi8(d, zero);
+
+    __m128i p0 = blend_lanes(_mm_unpacklo_epi16(lo, zero), inv, rgb, alpha_lane);
+    __m128i p1 = blend_lanes(_mm_unpackhi_epi16(lo, zero), inv, rgb, alpha_lane);
+    __m128i p2 = blend_lanes(_mm_unpacklo_epi16(hi, zero), inv, rgb, alpha_lane);
+    __m128i p3 = blend_lanes(_mm_unpackhi_epi16(hi, zero), inv, rgb, alpha_lane);
+
+    d = _mm_packus_epi16(_mm_packs_epi32(p0, p1), _mm_packs_epi32(p2, p3));
+    _mm_storeu_si128((__m128i*) (dst + 4 * i), d);
+  }
+#endif
+
+  for (; i < n; i++) {
+    blend_over(dst + 4 * i, src);
+  }
+}
+
+void blend_span_linear( unsigned char* dst, size_t n, const Premultiplied& src ) {
+  for (size_t i = 0; i < n; i++) {
+    blend_over_linear(dst + 4 * i, src);
+  }
+}
+
+void accumulate_span( uint32_t* sums, const unsigned char* src, size_t n ) {
+
+  size_t i = 0;
+
+#ifdef __SSE2__
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 4 <= n; i += 4) {
+    __m128i s = _mm_loadu_si128((const __m128i*) (src + 4 * i));
+    __m128i lo = _mm_unpacklo_epi8(s, zero);
+    __m128i hi = _mm_unpackhi_epi8(s, zero);
+    __m128i widened[4] = {
+      _mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+      _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero)
+    };
+    for (int k = 0; k < 4; k++) {
+      __m128i* sum = (__m128i*) (sums + 4 * i + 4 * k);
+      _mm_storeu_si128(sum, _mm_add_epi32(_mm_loadu_si128(sum), widened[k]));
+    }
+  }
+#endif
+
+  for (i *= 4; i < 4 * n; i++) {
+    sums[i] += src[i];
+  }
+}
+
+void average_span( unsigned char* dst, const uint32_t* sums, size_t n,
+                   size_t count ) {
+
+  // sum / count as a multiply by a rounded up reciprocal, exact for sums
+  // of up to 255 * count while count is below 4096
+  if (count >= 4096) {
+    for (size_t i = 0; i < 4 * n; i++) dst[i] = (uint8_t) (sums[i] / count);
+    return;
+  }
+  uint64_t reciprocal = (((uint64_t) 1) << 32) / count + 1;
+  for (size_t i = 0; i < 4 * n; i++) {
+    dst[i] = (uint8_t) ((sums[i] * reciprocal) >> 32);
+  }
+}
+
+void resolve_span_linear( unsigned char* dst, const unsigned char* src,
+                          size_t stride, size_t n, size_t count,
+                          unsigned char* lo, unsigned char* hi ) {
+
+  // the range of each channel over the planes
+  memcpy(lo, src, 4 * n);
+  memcpy(hi, src, 4 * n);
+  for (size_t k = 1; k < count; k++) {
+    const unsigned char* plane = src + k * stride;
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= 4 * n; i += 16) {
+      __m128i s = _mm_loadu_si128((const __m128i*) (plane + i));
+      __m128i* l = (__m128i*) (lo + i);
+      __m128i* h = (__m128i*) (hi + i);
+      _mm_storeu_si128(l, _mm_min_epu8(_mm_loadu_si128(l), s));
+      _mm_storeu_si128(h, _mm_max_epu8(_mm_loadu_si128(h), s));
+    }
+#endif
+    for (; i < 4 * n; i++) {
+      lo[i] = std::min(lo[i], plane[i]);
+      hi[i] = std::max(hi[i], plane[i]);
+    }
+  }
+
+  // pixels covered by one color keep it, the rest are averaged decoded.
+  // alpha is averaged as it is, the way average_span does
+  uint64_t reciprocal = (((uint64_t) 1) << 32) / count + 1;
+  float scale = 1.0f / count;
+  for (size_t i = 0; i < 4 * n; i += 4) {
+    if (!memcmp(lo + i, hi + i, 4)) {
+      memcpy(dst + i, lo + i, 4);
+      continue;
+    }
+    uint32_t sums[4] = { 0, 0, 0, 0 };
+    for (size_t k = 0; k < count; k++) {
+      const unsigned char* sample = src + k * stride + i;
+      sums[0] += srgb_decode[sample[0]];
+      sums[1] += srgb_decode[sample[1]];
+      sums[2] += srgb_decode[sample[2]];
+      sums[3] += sample[3];
+    }
+    average_linear(dst + i, sums, scale, reciprocal);
+  }
+}
+
+// the separable blend functions of the compositing spec, on the
+// unpremultiplied backdrop b and source s
+static float blend_channel( BlendMode mode, float b, float s ) {
+
+  switch (mode) {
+  case BLEND_MULTIPLY:
+    return b * s;
+  case BLEND_SCREEN:
+    return b + s - b * s;
+  case BLEND_OVERLAY:
+    return blend_channel(BLEND_HARD_LIGHT, s, b);
+  case BLEND_DARKEN:
+    return std::min(b, s);
+  case BLEND_LIGHTEN:
+    return std::max(b, s);
+  case BLEND_COLOR_DODGE:
+    if (b == 0) return 0;
+    return s >= 1 ? 1 : std::min(1.0f, b / (1 - s));
+  case BLEND_COLOR_BURN:
+    if (b >= 1) return 1;
+    return s <= 0 ? 0 : 1 - std::min(1.0f, (1 - b) / s);
+  case BLEND_HARD_LIGHT:
+    return s <= 0.5f ? b * 2 * s : blend_channel(BLEND_SCREEN, b, 2 * s - 1);
+  case BLEND_SOFT_LIGHT: {
+    if (s <= 0.5f) return b - (1 - 2 * s) * b * (1 - b);
+    float d = b <= 0.25f ? ((16 * b - 12) * b + 4) * b : std::sqrt(b);
+    return b + (2 * s - 1) * (d - b);
+  }
+  case BLEND_DIFFERENCE:
+    return std::fabs(b - s);
+  case BLEND_EXCLUSION:
+    return b + s - 2 * b * s;
+  default:
+    return s;
+  }
+}
+
+static inline unsigned char to_byte( float v ) {
+  return (unsigned char) (std::max(0.0f, std::min(v, 1.0f)) * 255 + 0.5f);
+}
+
+void composite_span( unsigned char* dst, const unsigned char* src, size_t n,
+                     float opacity, BlendMode mode, bool linear ) {
+
+  const float inv255 = 1.0f / 255;
+  const float inv65535 = 1.0f / 65535;
+  for (size_t i = 0; i < n; i++, dst += 4, src += 4) {
+
+    // samples the group left untouched change nothing
+    if (!src[3]) continue;
+
+    float sa = src[3] * inv255;
+    float da = dst[3] * inv255;
+
+    for (int c = 0; c < 3; c++) {
+      float sc = linear ? srgb_decode[src[c]] * inv65535 : src[c] * inv255;
+      float dc = linear ? srgb_decode[dst[c]] * inv65535 : dst[c] * inv255;
+      float v = sc * opacity + dc * (1 - sa * opacity);
+      if (mode != BLEND_NORMAL) {
+        float s = std::min(sc / sa, 1.0f);
+        float b = dst[3] ? std::min(dc / da, 1.0f) : 0;
+        v = sc * opacity * (1 - da) + dc * (1 - sa * opacity) +
+            sa * opacity * da * blend_channel(mode, b, s);
+      }
+      dst[c] = linear ? srgb_encode16((uint32_t) (std::max(v, 0.0f) * 65535 + 0.5f))
+                      : to_byte(v);
+    }
+    dst[3] = to_byte(sa * opacity + da * (1 - sa * opacity));
+  }
+}
+
+LayerPool::~LayerPool() {
+  for (size_t i = 0; i < buffers.size(); i++) delete[] buffers[i].data;
+}
+
+unsigned char* LayerPool::acquire( size_t size ) {
+
+  // the smallest free buffer that fits, or else the largest one grown
+  Buffer* fit = NULL;
+  Buffer* largest = NULL;
+  for (size_t i = 0; i < buffers.size(); i++) {
+    Buffer& b = buffers[i];
+    if (b.used) continue;
+    if (b.size >= size && (!fit || b.size < fit->size)) fit = &b;
+    if (!largest || b.size > largest->size) largest = &b;
+  }
+
+  if (!fit && largest) {
+    delete[] largest->data;
+    largest->data = new unsigned char[size];
+    largest->size = size;
+    fit = largest;
+  }
+
+  if (!fit) {
+    Buffer b = { new unsigned char[size], size, false };
+    buffers.push_back(b);
+    fit = &buffers.back();
+  }
+
+  fit->used = true;
+  return fit->data;
+}
+
+void LayerPool::release( unsigned char* buffer ) {
+  for (size_t i = 0; i < buffers.size(); i++) {
+    if (buffers[i].data == buffer) buffers[i].used = false;
+  }
+}
+
+} // namespace CS248
@@ -0,0 +1,163 @@
+#ifndef CS248_COMPOSITE_H
+#define CS248_COMPOSITE_H
+
+#include <stdint.h>
+#include "CS248.h"
+#include "color.h"
+#include "svg.h"
+
+namespace CS248 {
+
+// Compositing on the sample buffer, which holds premultiplied RGBA8. A
+// source color is premultiplied once per primitive and blended "over"
+// the samples it covers:
+//
+//   dst.rgb = src.rgb * src.a + dst.rgb * (1 - src.a)
+//   dst.a   = 1 - (1 - src.a) * (1 - dst.a)
+//
+// The arithmetic is done in single precision and truncated back to 8
+// bits, in the same order of operations as the reference renderer, so
+// that both round identically.
+//
+// Samples are sRGB encoded. The *_linear variants decode them to linear
+// light first and encode the result again, through the tables below, so
+// that blending and averaging mix light rather than encoded values.
+
+// the sRGB transfer function: 8 bit encoded values to 16 bit linear ones,
+// and 16 bit linear values back by their top 12 bits. Encoding a decoded
+// value gives it back
+extern uint16_t srgb_decode[256];
+extern uint8_t srgb_encode[4096];
+
+inline uint8_t srgb_encode16( uint32_t linear ) {
+  return srgb_encode[(linear > 65535 ? 65535 : linear) >> 4];
+}
+
+struct Premultiplied {
+  float rgb[3];           // channels times alpha
+  float inv;              // one minus alpha
+  bool opaque;            // replaces whatever it is blended over
+  unsigned char rgba[4];  // the sample an opaque color leaves behind
+
+  // linear light channels times alpha and one minus alpha, 16 bit fixed
+  // point, if premultiplied for linear blending
+  uint16_t linear[3];
+  uint32_t linear_inv;
+};
+
+// true if a color replaces what it is drawn over
+inline bool is_opaque( const Color& c ) {
+  return c.a == 1;
+}
+
+// a color premultiplied by its alpha, for linear blending too if asked
+inline Premultiplied premultiply( const Color& c, bool linear = false ) {
+  Premultiplied p;
+  p.rgb[0] = c.r * c.a;
+  p.rgb[1] = c.g * c.a;
+  p.rgb[2] = c.b * c.a;
+  p.inv = 1 - c.a;
+  p.opaque = is_opaque(c);
+  p.rgba[0] = (uint8_t) (c.r * 255);
+  p.rgba[1] = (uint8_t) (c.g * 255);
+  p.rgba[2] = (uint8_t) (c.b * 255);
+  p.rgba[3] = 255;
+  if (linear) {
+    float a = c.a < 0 ? 0 : (c.a > 1 ? 1 : c.a);
+    for (int i = 0; i < 3; i++) {
+      p.linear[i] = (uint16_t) (srgb_decode[p.rgba[i]] * a + 0.5f);
+    }
+    p.linear_inv = (uint32_t) ((1 - a) * 65536 + 0.5f);
+  }
+  return p;
+}
+
+// blend a premultiplied color over a single sample
+inline void blend_over( unsigned char* dst, const Premultiplied& src ) {
+  const float inv255 = 1.0f / 255;
+  for (int i = 0; i < 3; i++) {
+    dst[i] = (uint8_t) ((src.inv * (dst[i] * inv255) + src.rgb[i]) * 255);
+  }
+  dst[3] = (uint8_t) ((1 - src.inv * (1 - dst[3] * inv255)) * 255);
+}
+
+// blend a premultiplied color over n consecutive samples, four at a time
+// where SSE2 is available
+void blend_span( unsigned char* dst, size_t n, const Premultiplied& src );
+
+// blend_over in linear light, for a color premultiplied for it
+inline void blend_over_linear( unsigned char* dst, const Premultiplied& src ) {
+  const float inv255 = 1.0f / 255;
+  for (int i = 0; i < 3; i++) {
+    uint32_t below = (srgb_decode[dst[i]] * src.linear_inv + 32768) >> 16;
+    dst[i] = srgb_encode16(src.linear[i] + below);
+  }
+  dst[3] = (uint8_t) ((1 - src.inv * (1 - dst[3] * inv255)) * 255);
+}
+
+void blend_span_linear( unsigned char* dst, size_t n, const Premultiplied& src );
+
+// add n consecutive samples to per channel sums, for resolving sample
+// planes a row at a time
+void accumulate_span( uint32_t* sums, const unsigned char* src, size_t n );
+
+// store the truncated averages of n samples summed over count planes
+void average_span( unsigned char* dst, const uint32_t* sums, size_t n,
+                   size_t count );
+
+// the average of count samples in linear light, from the sums of their
+// decoded channels and of their alpha, with scale = 1 / count and
+// reciprocal = 2^32 / count + 1
+inline void average_linear( unsigned char* dst, const uint32_t* sums,
+                            float scale, uint64_t reciprocal ) {
+  dst[0] = srgb_encode16((uint32_t) (sums[0] * scale + 0.5f));
+  dst[1] = srgb_encode16((uint32_t) (sums[1] * scale + 0.5f));
+  dst[2] = srgb_encode16((uint32_t) (sums[2] * scale + 0.5f));
+  dst[3] = (uint8_t) ((sums[3] * reciprocal) >> 32);
+}
+
+// average n samples over count planes in linear light, plane k starting
+// at src + k * stride. Only pixels whose samples differ are decoded, lo
+// and hi are scratch space for 4 * n bytes each
+void resolve_span_linear( unsigned char* dst, const unsigned char* src,
+                          size_t stride, size_t n, size_t count,
+                          unsigned char* lo, unsigned char* hi );
+
+// composite n samples of a group's layer over the samples below it, with
+// the group's opacity and blend mode, in linear light if asked. Both hold
+// premultiplied RGBA8
+void composite_span( unsigned char* dst, const unsigned char* src, size_t n,
+                     float opacity, BlendMode mode, bool linear = false );
+
+// Off-screen buffers for group layers. Buffers are returned to the pool
+// when their layer has been composited and handed out again to later
+// layers, of this frame or the next, so drawing layered groups settles
+// into as many allocations as layers are nested.
+class LayerPool {
+ public:
+
+  LayerPool() { }
+  ~LayerPool();
+
+  // a buffer of at least size bytes, owned by the pool
+  unsigned char* acquire( size_t size );
+
+  // hand a buffer from acquire back for reuse
+  void release( unsigned char* buffer );
+
+ private:
+
+  struct Buffer {
+    unsigned char* data;
+    size_t size;
+    bool used;
+  };
+  std::vector<Buffer> buffers;
+
+  LayerPool( const LayerPool& );
+  LayerPool& operator=( const LayerPool& );
+};
+
+} // namespace CS248
+
+#endif // CS248_COMPOSITE_H
@@ -0,0 +1,94 @@
+#include "corpus.h"
+
+#include <sys/stat.h>
+#include <dirent.h>
+#include <iostream>
+#include <algorithm>
+
+using namespace std;
+
+namespace CS248 {
+
+void find_svg_files( const string& path, vector<string>& files ) {
+
+  struct stat st;
+  if (stat(path.c_str(), &st) < 0) {
+    cerr << "File does not exist: " << path << endl;
+    return;
+  }
+
+  if (st.st_mode & S_IFREG) {
+    files.push_back(path);
+    return;
+  }
+
+  DIR* dir = opendir(path.c_str());
+  if (!dir) {
+    cerr << "Could not open directory " << path << endl;
+    return;
+  }
+
+  string pathname = path;
+  if (pathname.back() != '/') pathname.push_back('/');
+
+  vector<string> entries;
+  struct dirent* ent;
+  while ((ent = readdir(dir)) != NULL) {
+    string name = ent->d_name;
+    if (name != "." && name != "..") entries.push_back(name);
+  }
+  closedir(dir);
+
+  // visit in a stable order so runs can be compared line by line
+  sort(entries.begin(), entries.end());
+  for (size_t i = 0; i < entries.size(); i++) {
+    string child = pathname + entries[i];
+    if (stat(child.c_str(), &st) < 0) continue;
+    if (st.st_mode & S_IFDIR) {
+      find_svg_files(child, files);
+    } else if (child.size() > 4 && child.substr(child.size() - 4) == ".svg") {
+      files.push_back(child);
+    }
+  }
+}
+
+void decode_textures( vector<SVGElement*>& elements ) {
+
+  for (size_t i = 0; i < elements.size(); ++i) {
+    if (elements[i]->type == IMAGE) {
+      decode_texture(static_cast<Image*>(elements[i])->tex);
+    } else if (elements[i]->type == GROUP) {
+      decode_textures(static_cast<Group*>(elements[i])->elements);
+    }
+  }
+}
+
+void generate_mipmaps( vector<SVGElement*>& elements, Sampler2D* sampler ) {
+
+  for (size_t i = 0; i < elements.size(); ++i) {
+    if (elements[i]->type == IMAGE) {
+      Texture& tex = static_cast<Image*>(elements[i])->tex;
+      if (tex.encoded.empty()) sampler->generate_mips(tex, 0);
+    } else if (elements[i]->type == GROUP) {
+      generate_mipmaps(static_cast<Group*>(elements[i])->elements, sampler);
+    }
+  }
+}
+
+Matrix3x3 view_transform( Viewport& viewport, const SVG& svg,
+                          float cx, float cy, float zoom,
+                          size_t width, size_t height ) {
+
+  float w = svg.width, h = svg.height;
+  float span = 1.2 * max(w, h) / 2 / zoom;
+  viewport.set_viewbox(w * cx, h * cy, span);
+
+  Matrix3x3 norm_to_screen = Matrix3x3::identity();
+  float scale = min(width, height);
+  norm_to_screen(0,0) = scale; norm_to_screen(0,2) = (width  - scale) / 2;
+  norm_to_screen(1,1) = scale; norm_to_screen(1,2) = (height - scale) / 2;
+
+  return norm_to_screen * viewport.get_canvas_to_norm();
+}
+
+} // namespace CS248
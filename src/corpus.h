@@ -0,0 +1,34 @@
+#ifndef CS248_CORPUS_H
+#define CS248_CORPUS_H
+
+#include <string>
+#include <vector>
+
+#include "svg.h"
+#include "texture.h"
+#include "viewport.h"
+
+namespace CS248 {
+
+// Helpers shared by the programs that run over the bundled svg files
+// without a viewer (drawsvg_regress, drawsvg-bench).
+
+// the svg files at a path, or under it in name order if it is a directory
+void find_svg_files( const std::string& path, std::vector<std::string>& files );
+
+// decode the images of an element list and its groups
+void decode_textures( std::vector<SVGElement*>& elements );
+
+// build mipmaps of the decoded images with a sampler
+void generate_mipmaps( std::vector<SVGElement*>& elements, Sampler2D* sampler );
+
+// canvas to screen transform the viewer uses for a window of the given
+// size, centered on (cx, cy) as a fraction of the canvas and zoomed in by
+// zoom from the view that fits the canvas
+Matrix3x3 view_transform( Viewport& viewport, const SVG& svg,
+                          float cx, float cy, float zoom,
+                          size_t width, size_t height );
+
+} // namespace CS248
+
+#endif // CS248_CORPUS_H
@@ -0,0 +1,138 @@
+#include "coverage.h"
+
+#include <cmath>
+#include <algorithm>
+
+namespace CS248 {
+
+void CoverageRaster::begin( int ox, int oy, int x0, int y0, int x1, int y1 ) {
+
+  this->ox = ox;
+  this->oy = oy;
+  this->x0 = x0;
+  this->y0 = y0;
+  w = x1 > x0 ? x1 - x0 : 0;
+  h = y1 > y0 ? y1 - y0 : 0;
+
+  // rows are cleared as they are read, so only growth needs clearing
+  if (cells.size() < (w + 2) * h) cells.resize((w + 2) * h, 0);
+  if (levels.size() < w) levels.resize(w);
+}
+
+void CoverageRaster::edge( double ax, double ay, double bx, double by ) {
+
+  if (ay == by || !w || !h) return;
+
+  float px = (float) (ax - ox), py = (float) (ay - oy);
+  float qx = (float) (bx - ox), qy = (float) (by - oy);
+
+  // parts of the edge left of the pixels cover them completely, so they
+  // are moved onto the left side, and parts right of them are moved
+  // onto the right side where they cover nothing. Split the edge where
+  // it crosses either side
+  float sides[2] = { (float) (x0 - ox), (float) (x0 - ox + (int) w) };
+  float ts[2];
+  int n = 0;
+  for (int k = 0; k < 2; k++) {
+    if ((px < sides[k]) != (qx < sides[k])) ts[n++] = (sides[k] - px) / (qx - px);
+  }
+  if (n == 2 && ts[0] > ts[1]) std::swap(ts[0], ts[1]);
+
+  float sx = px, sy = py;
+  for (int k = 0; k <= n; k++) {
+    float ex = k < n ? px + (qx - px) * ts[k] : qx;
+    float ey = k < n ? py + (qy - py) * ts[k] : qy;
+
+    // the piece lies on one side or between them
+    float mid = (sx + ex) / 2;
+    if (mid <= sides[0] || mid >= sides[1]) {
+      float side = mid <= sides[0] ? sides[0] : sides[1];
+      accumulate(side, sy, side, ey);
+    } else {
+      accumulate(std::min(std::max(sx, sides[0]), sides[1]), sy,
+                 std::min(std::max(ex, sides[0]), sides[1]), ey);
+    }
+
+    sx = ex; sy = ey;
+  }
+}
+
+void CoverageRaster::accumulate( float ax, float ay, float bx, float by ) {
+
+  if (ay == by) return;
+
+  // walk the edge downwards, with the sign of its direction
+  float dir = 1;
+  if (ay > by) {
+    std::swap(ax, bx);
+    std::swap(ay, by);
+    dir = -1;
+  }
+
+  // the rows of the pixels it crosses. x is found from the start of the
+  // edge in each row, so that it does not depend on the first row
+  int row0 = y0 - oy;
+  int y_begin = std::max((int) std::floor(ay), row0);
+  int y_end = std::min((int) std::ceil(by), row0 + (int) h);
+  float dxdy = (bx - ax) / (by - ay);
+  int column0 = x0 - ox;
+  size_t stride = w + 2;
+
+  // rounding may not move the edge off the columns
+  float left_side = (float) column0, right_side = (float) (column0 + (int) w);
+
+  for (int y = y_begin; y < y_end; y++) {
+    float* cell = &cells[(y - row0) * stride] - column0;
+
+    float top = std::max((float) y, ay), bottom = std::min((float) (y + 1), by);
+    float x = std::min(std::max(ax + (top - ay) * dxdy, left_side), right_side);
+    float x_next = std::min(std::max(ax + (bottom - ay) * dxdy, left_side), right_side);
+    float d = (bottom - top) * dir;
+
+    float left = std::min(x, x_next), right = std::max(x, x_next);
+    float left_floor = std::floor(left);
+    int i0 = (int) left_floor;
+    int i1 = (int) std::ceil(right);
+
+    if (i1 <= i0 + 1) {
+      // within a single cell, split by the mean x of the edge in the row
+      float mid = 0.5f * (x + x_next) - left_floor;
+      cell[i0] += d - d * mid;
+      cell[i0 + 1] += d * mid;
+    } else {
+      // across several cells, each gets the trapezoid of the edge over it
+      float s = 1 / (right - left);
+      float f0 = left - left_floor;
+      float a0 = 0.5f * s * (1 - f0) * (1 - f0);
+      float f1 = right - i1 + 1;
+      float am = 0.5f * s * f1 * f1;
+      cell[i0] += d * a0;
+      if (i1 == i0 + 2) {
+        cell[i0 + 1] += d * (1 - a0 - am);
+      } else {
+        float a1 = s * (1.5f - f0);
+        cell[i0 + 1] += d * (a1 - a0);
+        for (int i = i0 + 2; i < i1 - 1; i++) cell[i] += d * s;
+        float a2 = a1 + (i1 - i0 - 3) * s;
+        cell[i1 - 1] += d * (1 - a2 - am);
+      }
+      cell[i1] += d * am;
+    }
+  }
+}
+
+const unsigned char* CoverageRaster::row( int y ) {
+
+  float* cell = &cells[(y - y0) * (w + 2)];
+  float sum = 0;
+  for (size_t i = 0; i < w; i++) {
+    sum += cell[i];
+    float c = std::min(std::fabs(sum), 1.0f);
+    levels[i] = (unsigned char) (c * 255 + 0.5f);
+    cell[i] = 0;
+  }
+  cell[w] = cell[w + 1] = 0;
+  return &levels[0];
+}
+
+} // namespace CS248
@@ -0,0 +1,49 @@
+#ifndef CS248_COVERAGE_H
+#define CS248_COVERAGE_H
+
+#include <stddef.h>
+#include <vector>
+
+namespace CS248 {
+
+// Exact area coverage of a closed outline, accumulated the way font
+// rasterizers do. Each edge adds the signed area it sweeps to the cells of
+// the rows it crosses, so that a running sum along a row gives the
+// fraction of each pixel inside the outline. The cost grows with the
+// length of the edges rather than with a number of samples per pixel.
+// Overlapping parts of an outline count once, as with the nonzero rule.
+class CoverageRaster {
+ public:
+
+  CoverageRaster() : ox(0), oy(0), x0(0), y0(0), w(0), h(0) { }
+
+  // start an outline over the pixels [x0, x1) x [y0, y1), the parts of it
+  // outside are clipped away. Edges are measured from the pixel (ox, oy),
+  // which should depend on the outline alone, so that an outline drawn in
+  // parts under different clip rectangles adds up the same way in each
+  void begin( int ox, int oy, int x0, int y0, int x1, int y1 );
+
+  // add an edge of the outline, in the same coordinates as the pixels
+  void edge( double ax, double ay, double bx, double by );
+
+  // the coverage of the pixels [x0, x1) of row y in 0..255, once all edges
+  // are in. Clears the row for the next outline
+  const unsigned char* row( int y );
+
+ private:
+
+  int ox, oy;
+  int x0, y0;
+  size_t w, h;
+
+  // signed area per cell, a row of w + 2 cells per pixel row
+  std::vector<float> cells;
+  std::vector<unsigned char> levels;
+
+  // add an edge relative to the origin, within the columns of the pixels
+  void accumulate( float ax, float ay, float bx, float by );
+};
+
+} // namespace CS248
+
+#endif // CS248_COVERAGE_H
@@ -1,6 +1,8 @@
 #include "drawsvg.h"
 
+#include <cmath>
 #include <sstream>
+#include <iomanip>
 #include <iostream>
 #include <cstdlib>
 
@@ -10,6 +12,17 @@ namespace CS248 {
 
 DrawSVG::~DrawSVG() {
 
+  // stop the render thread, abandoning the frame in flight
+  if (worker.joinable()) {
+    {
+      lock_guard<mutex> lock(job_lock);
+      quit = true;
+      cancel = true;
+    }
+    job_cond.notify_one();
+    worker.join();
+  }
+
   tabs.clear();
   viewport_imp.clear();
   viewport_ref.clear();
@@ -25,15 +38,33 @@ string DrawSVG::name() {
 
 string DrawSVG::info() {
 
-  if (show_diff) return osd;
+  if (show_diff) {
+    lock_guard<mutex> lock(frame_lock);
+    return diff_osd;
+  }
 
   osd = "Software Renderer ";
   if (software_renderer == software_renderer_ref) {
     osd += "- Reference";
   }
-  if (sample_rate > 1) {
+  if (analytic_coverage && software_renderer == software_renderer_imp) {
+    osd += "(analytic coverage AA)";
+  } else if (sample_rate > 1) {
     osd += "( " + to_string(sample_rate * sample_rate) + "x SSAA)";
   }
+  if (occlusion_culling && software_renderer == software_renderer_imp) {
+    osd += " (occlusion culling)";
+  }
+  if (linear_light && software_renderer == software_renderer_imp) {
+    osd += " (linear light)";
+  }
+  if (compressed_samples && software_renderer == software_renderer_imp) {
+    osd += " (compressed samples)";
+  }
+  if (kInstrumented && software_renderer == software_renderer_imp) {
+    lock_guard<mutex> lock(frame_lock);
+    if (!instrument_osd.empty()) osd += " - " + instrument_osd;
+  }
 
   return osd;
 }
@@ -53,7 +84,10 @@ void DrawSVG::init() {
   software_renderer_imp->set_tex_sampler(sampler_imp);
   software_renderer_ref->set_tex_sampler(sampler_ref);
 
-  // generate mipmaps & set initial viewports
+  // let the render thread abandon stale frames
+  static_cast<SoftwareRendererImp*>(software_renderer_imp)->set_cancel_flag(&cancel);
+
+  // set initial viewports
   for (size_t i = 0; i < tabs.size(); ++i) {
 
 	// NOTE: CS248 changes for students not to implement viewports
@@ -66,8 +100,7 @@ void DrawSVG::init() {
     // set initial canvas_to_norm for imp using ref
     viewport_imp[i]->set_canvas_to_norm(viewport_ref[i]->get_canvas_to_norm());
 
-    // generate mipmaps
-    regenerate_mipmap(i);
+    // textures are decoded and mipmapped once they are first visible
   }
 
   // set tab and transformation if tabs loaded
@@ -76,11 +109,20 @@ void DrawSVG::init() {
   // initial osd
   osd = "Software Renderer";
 
+  // all drawing happens on the render thread from here on
+  worker = thread(&DrawSVG::render_loop, this);
+
 }
 
 void DrawSVG::render() {
 
-  display_pixels( &framebuffer[0] );
+  // show the most recent completed frame
+  {
+    lock_guard<mutex> lock(frame_lock);
+    if (!framebuffer.empty()) {
+      display_pixels( &framebuffer[0], front_w, front_h );
+    }
+  }
 
   if (show_zoom) {
     draw_zoom();
@@ -93,10 +135,7 @@ void DrawSVG::resize( size_t width, size_t height ) {
   this->width  = width;
   this->height = height;
 
-  // resize pixel buffer
-  framebuffer.resize( 4 * width * height);
-  software_renderer_imp->set_pixel_buffer(&framebuffer[0], width, height);
-  software_renderer_ref->set_pixel_buffer(&framebuffer[0], width, height);
+  // the render thread resizes its buffers with the next job
 
   // re-adjust norm_to_screen
   float scale = min(width, height);
@@ -151,11 +190,11 @@ void DrawSVG::char_event( unsigned int key ) {
     // switch between iml and ref sampler
     case ';':
       sampler = sampler_imp;
-      regenerate_mipmap(current_tab); redraw();
+      redraw();
       break;
     case '\'':
       sampler = sampler_ref;
-      regenerate_mipmap(current_tab); redraw();
+      redraw();
       break;
 
     // toggle diff
@@ -164,9 +203,44 @@ void DrawSVG::char_event( unsigned int key ) {
       redraw();
       break;
 
+    // trace the next frame of the implementation
+    case 't': case 'T':
+      if (!kInstrumented) {
+        cerr << "Tracing needs a build with -DBUILD_INSTRUMENTED=ON" << endl;
+        break;
+      }
+      trace_request = true;
+      redraw();
+      break;
+
+    // toggle occlusion culling
+    case 'o': case 'O':
+      occlusion_culling = !occlusion_culling;
+      redraw();
+      break;
+
+    // toggle linear light blending
+    case 'l': case 'L':
+      linear_light = !linear_light;
+      redraw();
+      break;
+
+    // toggle compressed samples
+    case 'c': case 'C':
+      compressed_samples = !compressed_samples;
+      redraw();
+      break;
+
+    // toggle analytic coverage anti-aliasing
+    case 'a': case 'A':
+      analytic_coverage = !analytic_coverage;
+      redraw();
+      break;
+
     // toggle zoom
     case 'z': case 'Z':
       show_zoom = !show_zoom;
+      invalidate();
       break;
 
     // tab selection
@@ -229,38 +303,37 @@ void DrawSVG::mouse_event(int key, int event, unsigned char mods) {
 void DrawSVG::cursor_event( float x, float y ) {
   
   // translate when left mouse button is held down
-  // diff is disabled when panning - it's too slow
   if (leftDown) {
-    show_diff = false;
-
 	float dx = (x - cursor_x) / width  * tabs[current_tab]->width;
     float dy = (y - cursor_y) / height * tabs[current_tab]->height;
     viewport_imp[current_tab]->update_viewbox(dx, dy, 1);
     viewport_ref[current_tab]->update_viewbox(dx, dy, 1);
-    redraw();
+    redraw_preview();
   }
   
+  // the zoom view follows the cursor
+  if (show_zoom) invalidate();
+
   // register new cursor location
   cursor_x = x;
   cursor_y = y;
 }
 
 void DrawSVG::scroll_event( float offset_x, float offset_y ) {
-  // diff is disabled when zooming - it's too slow
   if (offset_x || offset_y) {
-    show_diff = false;
-
 	// prevent inverting axis when scrolling too fast
     float scale = 1 + 0.05 * offset_x + 0.05 * offset_y;
     scale = scale < 0.5 ? 0.5 : (scale > 1.5 ? 1.5 : scale); 
     viewport_imp[current_tab]->update_viewbox(0, 0, scale);
     viewport_ref[current_tab]->update_viewbox(0, 0, scale);
-    redraw();
+    redraw_preview();
   }
 }
 
 void DrawSVG::clear( void ) {
-  software_renderer->clear_buffer();    
+  lock_guard<mutex> lock(frame_lock);
+  if (!framebuffer.empty()) memset(&framebuffer[0], 255, framebuffer.size());
+  invalidate();
 }
 
 void DrawSVG::newTab( SVG* svg ) {
@@ -289,48 +362,94 @@ void DrawSVG::setTab( size_t tab_index ) {
   }
 }
 
-void DrawSVG::draw_diff() {
+void DrawSVG::draw_diff( const RenderJob& job ) {
 
   // get reference output
-  software_renderer_ref->draw_svg(*tabs[current_tab]);
+  software_renderer_ref->clear_buffer();
+  software_renderer_ref->draw_svg(*tabs[job.tab]);
   
   // save reference output
-  vector<unsigned char> reference ( 4 * width * height );
-  memcpy(&reference[0], &framebuffer[0], 4 * width * height );
-  memset(&framebuffer[0], 255, 4 * width * height);
+  size_t n = back_w * back_h;
+  diff_reference.resize(4 * n);
+  memcpy(&diff_reference[0], &backbuffer[0], 4 * n);
+  memset(&backbuffer[0], 255, 4 * n);
 
   // get implementation output
-  software_renderer_imp->draw_svg(*tabs[current_tab]);
+  software_renderer_imp->draw_svg(*tabs[job.tab]);
+  if (cancel) return;
+
+  // take the difference and measure it in one sweep, bands of rows in
+  // parallel, each summing into its own slot
+  int num_bands = (int) min(back_h, (size_t) 64);
+  diff_bands.resize(num_bands);
+
+  #pragma omp parallel for schedule(dynamic)
+  for (int band = 0; band < num_bands; band++) {
+
+    size_t begin = back_w * (back_h * band / num_bands);
+    size_t end = back_w * (back_h * (band + 1) / num_bands);
+    const unsigned char* ref = &diff_reference[0];
+    unsigned char* img = &backbuffer[0];
+
+    DiffStats s = { 0, 0, 0, 0 };
+    uint64_t squared_error = 0;
+    for (size_t i = begin; i < end; i++) {
+      int r = abs(ref[i*4 + 0] - img[i*4 + 0]);
+      int g = abs(ref[i*4 + 1] - img[i*4 + 1]);
+      int b = abs(ref[i*4 + 2] - img[i*4 + 2]);
+      img[i*4 + 0] = r;
+      img[i*4 + 1] = g;
+      img[i*4 + 2] = b;
+      img[i*4 + 3] = 255;
+
+      int magnitude = r * r + g * g + b * b;
+      squared_error += magnitude;
+      s.max_magnitude = max(s.max_magnitude, magnitude);
+      s.max_error = max(s.max_error, max(r, max(g, b)));
+      s.errors += (r | g | b) != 0;
+    }
 
-  // take difference and count errors
-  int errorCount = 0;
-  float max_error = 0;
-  for( size_t i = 0; i < width * height; i++ ) {
+    s.squared_error = squared_error;
+    diff_bands[band] = s;
+  }
 
-    framebuffer[i*4 + 0] = abs(reference[i*4 + 0] - framebuffer[i*4 + 0]);
-    framebuffer[i*4 + 1] = abs(reference[i*4 + 1] - framebuffer[i*4 + 1]);
-    framebuffer[i*4 + 2] = abs(reference[i*4 + 2] - framebuffer[i*4 + 2]);
-    framebuffer[i*4 + 3] = 255;
+  DiffStats total = { 0, 0, 0, 0 };
+  for (int band = 0; band < num_bands; band++) {
+    const DiffStats& s = diff_bands[band];
+    total.errors += s.errors;
+    total.max_error = max(total.max_error, s.max_error);
+    total.max_magnitude = max(total.max_magnitude, s.max_magnitude);
+    total.squared_error += s.squared_error;
+  }
 
-	if(normalize_diff) max_error = max(max_error, (float)framebuffer[i * 4 + 0] * framebuffer[i * 4 + 0] + framebuffer[i * 4 + 1] * framebuffer[i * 4 + 1] + framebuffer[i * 4 + 2] * framebuffer[i * 4 + 2]);
+  ostringstream info;
+  info << total.errors << " pixels different";
+  if (total.errors) {
+    double mse = total.squared_error / (3.0 * n);
+    info << fixed << setprecision(1)
+         << ", PSNR " << 10 * log10(255.0 * 255.0 / mse) << " dB"
+         << ", max error " << total.max_error;
+  }
+  diff_info = info.str();
 
-	for( int k = 0; k < 3; k++ ) {
-      if( framebuffer[i*4+k] ) {
-        errorCount++;
-        break;
-      }
+  // stretch the differences so the largest one is white
+  if (job.normalize_diff && total.max_magnitude > 0) {
+
+    float max_error = sqrt((float) total.max_magnitude);
+    unsigned char stretch[256];
+    for (int d = 0; d < 256; d++) {
+      stretch[d] = min((float) d / max_error * 255.f, 255.f);
     }
-  
-    osd = to_string(errorCount) + " pixels different";
-  }
 
-  if(normalize_diff && max_error > 0) {
-      max_error = sqrt(max_error);
-      for( size_t i = 0; i < width * height; i++ ) {
-        framebuffer[i*4 + 0] = (float)framebuffer[i * 4 + 0] / max_error * 255.f;
-        framebuffer[i*4 + 1] = (float)framebuffer[i * 4 + 1] / max_error * 255.f;
-        framebuffer[i*4 + 2] = (float)framebuffer[i * 4 + 2] / max_error * 255.f;
+    unsigned char* img = &backbuffer[0];
+    #pragma omp parallel for
+    for (int y = 0; y < (int) back_h; y++) {
+      for (size_t i = y * back_w; i < (y + 1) * back_w; i++) {
+        img[i*4 + 0] = stretch[img[i*4 + 0]];
+        img[i*4 + 1] = stretch[img[i*4 + 1]];
+        img[i*4 + 2] = stretch[img[i*4 + 2]];
       }
+    }
   }
 }
 
@@ -408,31 +527,227 @@ void DrawSVG::draw_zoom() {
 
 void DrawSVG::inc_sample_rate() {
   sample_rate += sample_rate < 4 ? 1 : 0;
-  software_renderer_imp->set_sample_rate(sample_rate);
-  software_renderer_ref->set_sample_rate(sample_rate);
   redraw();
 }
 
 void DrawSVG::dec_sample_rate() {
   sample_rate -= sample_rate > 1 ? 1 : 0;
-  software_renderer_imp->set_sample_rate(sample_rate);
-  software_renderer_ref->set_sample_rate(sample_rate);
   redraw();
 }
 
 void DrawSVG::redraw() {
+  submit(false);
+}
+
+void DrawSVG::redraw_preview() {
+  submit(true);
+}
+
+void DrawSVG::submit( bool preview ) {
+
+  RenderJob job;
+  job.tab = current_tab;
+  job.width = width; job.height = height;
+  job.sample_rate = sample_rate;
+  job.imp_to_screen = norm_to_screen * viewport_imp[current_tab]->get_canvas_to_norm();
+  job.ref_to_screen = norm_to_screen * viewport_ref[current_tab]->get_canvas_to_norm();
+  job.renderer = software_renderer;
+  job.sampler = sampler;
+  job.diff = show_diff;
+  job.normalize_diff = normalize_diff;
+  job.preview = preview;
+  job.occlusion_culling = occlusion_culling;
+  job.linear_light = linear_light;
+  job.compressed_samples = compressed_samples;
+  job.analytic_coverage = analytic_coverage;
+
+  // replace any job that has not started and stop the one in flight
+  {
+    lock_guard<mutex> lock(job_lock);
+    pending_job = job;
+    job_pending = true;
+    cancel = true;
+  }
+  job_cond.notify_one();
+}
+
+// Render thread //
+
+void DrawSVG::render_loop() {
+
+  while (true) {
+
+    RenderJob job;
+    {
+      unique_lock<mutex> lock(job_lock);
+      job_cond.wait(lock, [this] { return job_pending || quit; });
+      if (quit) return;
+      job = pending_job;
+      job_pending = false;
+      cancel = false;
+    }
 
-  clear();
+    execute(job);
+  }
+}
+
+void DrawSVG::execute( const RenderJob& job ) {
+
+  SoftwareRendererImp* imp = static_cast<SoftwareRendererImp*>(software_renderer_imp);
+  SVG& svg = *tabs[job.tab];
+
+  // follow window size and sample rate
+  if (job.width != back_w || job.height != back_h) {
+    back_w = job.width; back_h = job.height;
+    backbuffer.resize(4 * back_w * back_h);
+    software_renderer_imp->set_pixel_buffer(&backbuffer[0], back_w, back_h);
+    software_renderer_ref->set_pixel_buffer(&backbuffer[0], back_w, back_h);
+    scroll_ready = false;
+  }
+  software_renderer_imp->set_sample_rate(job.sample_rate);
+  software_renderer_ref->set_sample_rate(job.sample_rate);
+  imp->set_occlusion_culling(job.occlusion_culling);
+  imp->set_linear_light(job.linear_light);
+  imp->set_compressed_samples(job.compressed_samples);
+  imp->set_analytic_coverage(job.analytic_coverage);
 
   // set canvas_to_screen transformation
-  Matrix3x3 m_imp = norm_to_screen * viewport_imp[current_tab]->get_canvas_to_norm();
-  Matrix3x3 m_ref = norm_to_screen * viewport_ref[current_tab]->get_canvas_to_norm();
-  software_renderer_imp->set_canvas_to_screen( m_imp ); 
-  software_renderer_ref->set_canvas_to_screen( m_ref ); 
-
-  if (show_diff) { draw_diff(); return; }
-  software_renderer->draw_svg(*tabs[current_tab]);
-  display_pixels( &framebuffer[0] );
+  software_renderer_imp->set_canvas_to_screen(job.imp_to_screen);
+  software_renderer_ref->set_canvas_to_screen(job.ref_to_screen);
+
+  // mipmaps are built by the selected sampler
+  if (job.sampler != mip_sampler || job.tab != mip_tab) {
+    mip_sampler = job.sampler; mip_tab = job.tab;
+    regenerate_mipmap(job.tab);
+    scroll_ready = false;
+  }
+
+  // decode images that came into view
+  if (prepare_textures(svg.elements, job.imp_to_screen)) scroll_ready = false;
+  if (prepare_textures(svg.elements, job.ref_to_screen)) scroll_ready = false;
+
+  // pans shift the previous frame and only draw what came into view
+  if (job.preview && !job.diff && job.renderer == software_renderer_imp &&
+      scroll(job)) {
+    return;
+  }
+  if (cancel) return;
+
+  // anything else draws over the whole back buffer
+  scroll_ready = false;
+
+  if (job.diff) {
+    draw_diff(job);
+    if (!cancel) present(job);
+    return;
+  }
+
+  job.renderer->clear_buffer();
+
+  if (job.renderer == software_renderer_imp) {
+
+    // the implementation accumulates sample planes while previewing until
+    // done or a newer job arrives
+    if (job.preview) imp->draw_svg_progressive(svg);
+    else imp->draw_svg(svg);
+
+    drawn_tab = job.tab; drawn_rate = job.sample_rate;
+    drawn_linear = job.linear_light;
+    drawn_compressed = job.compressed_samples;
+    drawn_analytic = job.analytic_coverage;
+    drawn_to_screen = job.imp_to_screen;
+    refine(job);
+
+    if (!cancel && trace_request.exchange(false)) {
+      const char* path = "drawsvg_trace.json";
+      if (imp->get_instrumentation().write_trace(path)) {
+        cout << "Wrote a trace of the frame to " << path << endl;
+      } else {
+        cerr << "Could not write " << path << endl;
+      }
+    }
+    return;
+  }
+
+  // the reference renderer is drawn at 1x first while previewing
+  if (job.preview && job.sample_rate > 1) {
+    software_renderer_ref->set_sample_rate(1);
+    software_renderer_ref->draw_svg(svg);
+    software_renderer_ref->set_sample_rate(job.sample_rate);
+    if (cancel) return;
+    present(job);
+  }
+
+  job.renderer->draw_svg(svg);
+  if (!cancel) present(job);
+}
+
+bool DrawSVG::scroll( const RenderJob& job ) {
+
+  if (!scroll_ready) return false;
+  if (job.tab != drawn_tab || job.sample_rate != drawn_rate) return false;
+  if (job.linear_light != drawn_linear) return false;
+  if (job.compressed_samples != drawn_compressed) return false;
+  if (job.analytic_coverage != drawn_analytic) return false;
+
+  // only pure translations of the last frame can be reused
+  const Matrix3x3& m = job.imp_to_screen;
+  if (m(0,0) != drawn_to_screen(0,0) || m(0,1) != drawn_to_screen(0,1) ||
+      m(1,0) != drawn_to_screen(1,0) || m(1,1) != drawn_to_screen(1,1)) {
+    return false;
+  }
+
+  // snap the pan to whole pixels relative to the frame that was drawn, so
+  // the view is never more than half a pixel off
+  int dx = (int) round(m(0,2) - drawn_to_screen(0,2));
+  int dy = (int) round(m(1,2) - drawn_to_screen(1,2));
+  Matrix3x3 snapped = drawn_to_screen;
+  snapped(0,2) += dx; snapped(1,2) += dy;
+
+  SoftwareRendererImp* imp = static_cast<SoftwareRendererImp*>(software_renderer_imp);
+  imp->set_canvas_to_screen(snapped);
+  scroll_ready = false;
+
+  if (!imp->scroll_svg(*tabs[job.tab], dx, dy)) {
+    imp->set_canvas_to_screen(job.imp_to_screen);
+    return false;
+  }
+
+  drawn_to_screen = snapped;
+  refine(job);
+  return true;
+}
+
+void DrawSVG::refine( const RenderJob& job ) {
+
+  SoftwareRendererImp* imp = static_cast<SoftwareRendererImp*>(software_renderer_imp);
+
+  // present every sample plane, a cancelled plane leaves the ones before
+  // it in place so the frame can still be scrolled
+  while (!cancel) {
+    present(job);
+    scroll_ready = true;
+    if (!imp->refining()) break;
+    imp->refine_svg(*tabs[job.tab]);
+  }
+}
+
+void DrawSVG::present( const RenderJob& job ) {
+
+  {
+    lock_guard<mutex> lock(frame_lock);
+    framebuffer = backbuffer;
+    front_w = back_w; front_h = back_h;
+    if (job.diff) diff_osd = diff_info;
+    if (kInstrumented && job.renderer == software_renderer_imp) {
+      instrument_osd = static_cast<SoftwareRendererImp*>(software_renderer_imp)
+                         ->get_instrumentation().summary();
+    }
+  }
+
+  // wake up the viewer to show the new frame
+  invalidate();
+  glfwPostEmptyEvent();
 }
 
 void DrawSVG::regenerate_mipmap(size_t tab_index) {
@@ -443,12 +758,49 @@ void DrawSVG::regenerate_mipmap(size_t tab_index) {
       SVGElement* element = svg->elements[i];
       if (element->type == IMAGE) {
           Texture& tex = static_cast<Image*>(element)->tex;
-          sampler->generate_mips(tex, 0);
+          if (tex.encoded.empty()) mip_sampler->generate_mips(tex, 0);
       }
     }
   }
 }
 
+bool DrawSVG::prepare_textures(vector<SVGElement*>& elements,
+                               const Matrix3x3& canvas_to_screen) {
+
+  bool decoded = false;
+  for (size_t i = 0; i < elements.size(); ++i) {
+
+    SVGElement* element = elements[i];
+    Matrix3x3 m = canvas_to_screen * element->transform;
+
+    if (element->type == GROUP) {
+      if (prepare_textures(static_cast<Group*>(element)->elements, m)) decoded = true;
+      continue;
+    }
+
+    if (element->type != IMAGE) continue;
+    Image* image = static_cast<Image*>(element);
+    if (image->tex.encoded.empty()) continue;
+
+    // screen space bounds of the image rectangle
+    float x0 = INF_F, y0 = INF_F, x1 = -INF_F, y1 = -INF_F;
+    for (int k = 0; k < 4; k++) {
+      Vector3D p = m * Vector3D(image->position.x + (k & 1) * image->dimension.x,
+                                image->position.y + (k >> 1) * image->dimension.y, 1);
+      x0 = min(x0, (float)(p.x / p.z)); x1 = max(x1, (float)(p.x / p.z));
+      y0 = min(y0, (float)(p.y / p.z)); y1 = max(y1, (float)(p.y / p.z));
+    }
+
+    if (x1 < 0 || y1 < 0 || x0 > back_w || y0 > back_h) continue;
+    if (decode_texture(image->tex)) {
+      mip_sampler->generate_mips(image->tex, 0);
+      decoded = true;
+    }
+  }
+
+  return decoded;
+}
+
 void DrawSVG::auto_adjust(size_t tab_index) {
   
   float w = tabs[tab_index]->width;
@@ -459,7 +811,8 @@ void DrawSVG::auto_adjust(size_t tab_index) {
 }
 
 
-void DrawSVG::display_pixels( const unsigned char* pixels ) const {
+void DrawSVG::display_pixels( const unsigned char* pixels,
+                              size_t width, size_t height ) const {
 
   // copy pixels to the screen
   glPushAttrib( GL_VIEWPORT_BIT );
@@ -2,6 +2,10 @@
 #define CS248_DRAWSVG_H
 
 #include <vector>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
 
 #include "CS248.h"
 #include "renderer.h"
@@ -28,7 +32,19 @@ class DrawSVG : public Renderer {
     current_tab (0),
     show_diff (false),
     show_zoom (false),
-    norm_to_screen ( Matrix3x3::identity() )  { }
+    occlusion_culling (false),
+    linear_light (false),
+    compressed_samples (false),
+    analytic_coverage (false),
+    norm_to_screen ( Matrix3x3::identity() ),
+    back_w (0), back_h (0),
+    front_w (0), front_h (0),
+    mip_sampler (NULL),
+    scroll_ready (false),
+    job_pending (false),
+    quit (false),
+    cancel (false),
+    trace_request (false) { }
 
   /**
    * Destructor.
@@ -118,20 +134,41 @@ class DrawSVG : public Renderer {
   /* diff */
   bool show_diff;
   bool normalize_diff;
-  void draw_diff();
+  std::string diff_osd;
+
+  /* counters of the last frame of the implementation, in instrumented
+     builds only */
+  std::string instrument_osd;
   
   /* zoom */
   bool show_zoom;
   void draw_zoom();
 
+  /* draw the implementation with occlusion culling */
+  bool occlusion_culling;
+
+  /* blend and resolve the implementation in linear light */
+  bool linear_light;
+
+  /* keep the samples of the implementation as coverage fragments */
+  bool compressed_samples;
+
+  /* anti-alias fills of the implementation by their exact coverage */
+  bool analytic_coverage;
+
   /* samples rate (sqrt(s/pix)) */
   size_t sample_rate;
   void inc_sample_rate();
   void dec_sample_rate();
 
-  /* regenerate mipmap */
+  /* regenerate mipmap with the sampler in mip_sampler */
   void regenerate_mipmap(size_t tab_index);
 
+  /* decode textures of images visible under canvas_to_screen,
+     returns true if any were decoded */
+  bool prepare_textures(std::vector<SVGElement*>& elements,
+                        const Matrix3x3& canvas_to_screen);
+
   /* audo-adjust canvas_to_norm */
   void auto_adjust(size_t tab_index);
 
@@ -142,14 +179,88 @@ class DrawSVG : public Renderer {
   std::vector<Matrix3x3> viewport_save_imp;
   std::vector<Matrix3x3> viewport_save_ref;
 
-  /* framebuffer for software renderer */
-  std::vector<unsigned char> framebuffer;
+  /* software renderers draw into the back buffer on the render thread,
+     finished frames are copied to the front buffer for display */
+  std::vector<unsigned char> backbuffer; size_t back_w, back_h;
+  std::vector<unsigned char> framebuffer; size_t front_w, front_h;
+  std::mutex frame_lock;
+
+  /* everything the render thread needs to draw a frame, captured on the
+     ui thread so the two never share renderer state */
+  struct RenderJob {
+    size_t tab;
+    size_t width, height;
+    size_t sample_rate;
+    Matrix3x3 imp_to_screen;
+    Matrix3x3 ref_to_screen;
+    SoftwareRenderer* renderer;
+    Sampler2D* sampler;
+    bool diff, normalize_diff;
+    bool preview;
+    bool occlusion_culling;
+    bool linear_light;
+    bool compressed_samples;
+    bool analytic_coverage;
+  };
+
+  /* render thread state, only touched by the render thread */
+  Sampler2D* mip_sampler; size_t mip_tab;
+  std::string diff_info;
+
+  /* reference frame kept while the implementation draws over it */
+  std::vector<unsigned char> diff_reference;
+
+  /* difference of a band of rows, summed over the frame by draw_diff */
+  struct DiffStats {
+    size_t errors;         /* pixels differing in any channel */
+    int max_error;         /* largest difference in any channel */
+    int max_magnitude;     /* largest squared rgb difference */
+    double squared_error;  /* summed over the rgb channels */
+  };
+  std::vector<DiffStats> diff_bands;
+
+  /* the back buffer holds a frame of the implementation drawn with
+     drawn_to_screen, which pans can shift instead of redrawing */
+  bool scroll_ready;
+  size_t drawn_tab, drawn_rate;
+  bool drawn_linear, drawn_compressed, drawn_analytic;
+  Matrix3x3 drawn_to_screen;
+
+  /* latest requested job, replacing any job that was not started yet */
+  std::thread worker;
+  std::mutex job_lock;
+  std::condition_variable job_cond;
+  RenderJob pending_job;
+  bool job_pending;
+  bool quit;
+
+  /* set when a newer job arrives, the job in flight stops early */
+  std::atomic<bool> cancel;
+
+  /* write a trace of the next finished frame of the implementation */
+  std::atomic<bool> trace_request;
 
   // update framebuffer
   void redraw();
 
+  /* progressive rendering: one sample per pixel while panning or zooming,
+     refined in the background until a new job arrives */
+  void redraw_preview();
+
+  /* queue a frame for the render thread */
+  void submit(bool preview);
+
+  /* render thread */
+  void render_loop();
+  void execute(const RenderJob& job);
+  bool scroll(const RenderJob& job);
+  void refine(const RenderJob& job);
+  void draw_diff(const RenderJob& job);
+  void present(const RenderJob& job);
+
   /* update framebuffer for software renderer */
-  void display_pixels( const unsigned char* pixels ) const;
+  void display_pixels( const unsigned char* pixels,
+                       size_t width, size_t height ) const;
 
 };
 
@@ -0,0 +1,247 @@
+#include "fragment_buffer.h"
+#include "composite.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+namespace CS248 {
+
+static const uint32_t kWhite = 0xffffffff;
+
+// the four bytes of a sample as one value
+static inline uint32_t packed( const unsigned char* rgba ) {
+  uint32_t v;
+  memcpy(&v, rgba, 4);
+  return v;
+}
+
+static inline uint32_t count_bits( uint32_t v ) {
+  v = v - ((v >> 1) & 0x55555555);
+  v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+  return (((v + (v >> 4)) & 0x0f0f0f0f) * 0x01010101) >> 24;
+}
+
+void FragmentBuffer::resize( size_t width, size_t height, size_t samples ) {
+
+  this->width = width;
+  this->height = height;
+  this->samples = samples;
+  all = samples >= 32 ? 0xffffffff : (1u << samples) - 1;
+
+  pixels = (Pixel*) storage.reserve(width * height * sizeof(Pixel));
+  // an empty buffer gives back the memory of expanded pixels as well
+  if (!pixels) std::vector<unsigned char>().swap(expanded);
+}
+
+void FragmentBuffer::clear( int x0, int x1, int y, size_t begin, size_t end ) {
+
+  // from the first sample on, the pixels are white and no longer expanded
+  if (begin == 0) {
+    Pixel white = { { kWhite, kWhite }, 0 };
+    std::fill(&at(x0, y), &at(x0, y) + (x1 - x0), white);
+    return;
+  }
+
+  Pixel* p = &at(x0, y);
+  for (int x = x0; x < x1; x++, p++) {
+    if (!p->coverage && p->color[0] == kWhite) continue;
+    for (size_t s = begin; s < end; s++) set(*p, s, kWhite);
+  }
+}
+
+void FragmentBuffer::load( int x0, int x1, int y, size_t s,
+                           unsigned char* rgba ) const {
+  const Pixel* p = &at(x0, y);
+  for (int x = x0; x < x1; x++, p++, rgba += 4) {
+    memcpy(rgba, sample(*p, s), 4);
+  }
+}
+
+void FragmentBuffer::store( int x0, int x1, int y, size_t s,
+                            const unsigned char* rgba ) {
+  Pixel* p = &at(x0, y);
+  for (int x = x0; x < x1; x++, p++, rgba += 4) set(*p, s, packed(rgba));
+}
+
+void FragmentBuffer::fill( int x0, int x1, int y, size_t s,
+                           const unsigned char* rgba ) {
+  uint32_t color = packed(rgba);
+  Pixel* p = &at(x0, y);
+  for (int x = x0; x < x1; x++, p++) set(*p, s, color);
+}
+
+void FragmentBuffer::fill_pixels( int x0, int x1, int y,
+                                  const unsigned char* rgba ) {
+  Pixel covered = { { packed(rgba), packed(rgba) }, 0 };
+  std::fill(&at(x0, y), &at(x0, y) + (x1 - x0), covered);
+}
+
+// blend a premultiplied color over a sample in memory order
+static inline uint32_t blended( uint32_t sample, const Premultiplied& src,
+                                bool linear ) {
+  unsigned char rgba[4];
+  memcpy(rgba, &sample, 4);
+  if (linear) blend_over_linear(rgba, src);
+  else blend_over(rgba, src);
+  return packed(rgba);
+}
+
+void FragmentBuffer::blend_pixels( int x0, int x1, int y,
+                                   const Premultiplied& src, bool linear ) {
+
+  // neighbouring pixels mostly share their colors, so the last blend is
+  // kept around
+  uint32_t below = kWhite, above = blended(kWhite, src, linear);
+  Pixel* p = &at(x0, y);
+  for (int x = x0; x < x1; x++, p++) {
+    if (p->coverage & kExpanded) {
+      unsigned char* run = &expanded[4 * samples * (p->coverage & ~kExpanded)];
+      for (size_t s = 0; s < samples; s++) {
+        if (linear) blend_over_linear(run + 4 * s, src);
+        else blend_over(run + 4 * s, src);
+      }
+      continue;
+    }
+    for (int f = 0; f < (p->coverage ? 2 : 1); f++) {
+      if (p->color[f] != below) {
+        below = p->color[f];
+        above = blended(below, src, linear);
+      }
+      p->color[f] = above;
+    }
+
+    // both fragments may come out the same
+    if (p->coverage && p->color[0] == p->color[1]) p->coverage = 0;
+  }
+}
+
+void FragmentBuffer::set( Pixel& p, size_t s, uint32_t rgba ) {
+
+  if (p.coverage & kExpanded) {
+    memcpy(&expanded[4 * (samples * (p.coverage & ~kExpanded) + s)], &rgba, 4);
+    return;
+  }
+
+  uint32_t bit = 1u << s;
+  int f = (p.coverage & bit) ? 1 : 0;
+  if (p.color[f] == rgba) return;
+
+  // a single color gains a second fragment, unless the sample is all
+  // there is
+  if (!p.coverage) {
+    if (bit == all) {
+      p.color[0] = rgba;
+    } else {
+      p.color[1] = rgba;
+      p.coverage = bit;
+    }
+    return;
+  }
+
+  // the sample moves to the other fragment, which may then be all of them
+  if (p.color[1 - f] == rgba) {
+    p.coverage ^= bit;
+    if (p.coverage == all) {
+      p.color[0] = p.color[1];
+      p.coverage = 0;
+    }
+    return;
+  }
+
+  // a third color can only replace a fragment of this sample alone
+  uint32_t fragment = f ? p.coverage : all & ~p.coverage;
+  if (fragment == bit) {
+    p.color[f] = rgba;
+    return;
+  }
+
+  expand(p);
+  memcpy(&expanded[4 * (samples * (p.coverage & ~kExpanded) + s)], &rgba, 4);
+}
+
+void FragmentBuffer::expand( Pixel& p ) {
+
+  size_t index = expanded.size() / (4 * samples);
+  expanded.resize(expanded.size() + 4 * samples);
+  unsigned char* run = &expanded[4 * samples * index];
+  for (size_t s = 0; s < samples; s++) {
+    memcpy(run + 4 * s, &p.color[(p.coverage >> s) & 1], 4);
+  }
+  p.coverage = kExpanded | (uint32_t) index;
+}
+
+void FragmentBuffer::shift( int dx, int dy ) {
+
+  Pixel white = { { kWhite, kWhite }, 0 };
+
+  // rows in the order that keeps the source ahead of the destination, as
+  // shift_pixels does for the planes
+  int n = width - abs(dx);
+  int src_x = dx < 0 ? -dx : 0;
+  int dst_x = dx > 0 ?  dx : 0;
+  for (int k = 0; k < (int) height; k++) {
+    int y = dy > 0 ? height - 1 - k : k;
+    Pixel* row = &pixels[y * width];
+    int from = y - dy;
+    if (from < 0 || from >= (int) height) {
+      std::fill(row, row + width, white);
+      continue;
+    }
+    memmove(row + dst_x, &pixels[from * width + src_x], n * sizeof(Pixel));
+    std::fill(row + (dx > 0 ? 0 : width + dx), row + (dx > 0 ? dx : width), white);
+  }
+}
+
+void FragmentBuffer::resolve( unsigned char* dst, int x0, int x1, int y,
+                              size_t count, bool linear ) {
+
+  uint32_t mask = count >= 32 ? all : all & ((1u << count) - 1);
+  uint64_t reciprocal = (((uint64_t) 1) << 32) / count + 1;
+  float scale = 1.0f / count;
+
+  const Pixel* p = &at(x0, y);
+  for (int x = x0; x < x1; x++, p++, dst += 4) {
+
+    // pixels covered by one color keep it, the others are averaged the way
+    // average_span or resolve_span_linear average their planes
+    uint32_t sums[4] = { 0, 0, 0, 0 };
+    if (p->coverage & kExpanded) {
+      const unsigned char* run = sample(*p, 0);
+      bool uniform = true;
+      for (size_t k = 0; k < count; k++) {
+        const unsigned char* c = run + 4 * k;
+        uniform = uniform && !memcmp(c, run, 4);
+        sums[0] += linear ? srgb_decode[c[0]] : c[0];
+        sums[1] += linear ? srgb_decode[c[1]] : c[1];
+        sums[2] += linear ? srgb_decode[c[2]] : c[2];
+        sums[3] += c[3];
+      }
+      if (uniform) {
+        memcpy(dst, run, 4);
+        continue;
+      }
+    } else {
+      uint32_t n1 = count_bits(p->coverage & mask), n0 = count - n1;
+      if (!n0 || !n1) {
+        memcpy(dst, &p->color[n1 ? 1 : 0], 4);
+        continue;
+      }
+      const unsigned char* c0 = (const unsigned char*) &p->color[0];
+      const unsigned char* c1 = (const unsigned char*) &p->color[1];
+      for (int c = 0; c < 3; c++) {
+        sums[c] = linear ? srgb_decode[c0[c]] * n0 + srgb_decode[c1[c]] * n1
+                         : c0[c] * n0 + c1[c] * n1;
+      }
+      sums[3] = c0[3] * n0 + c1[3] * n1;
+    }
+
+    if (linear) {
+      average_linear(dst, sums, scale, reciprocal);
+    } else {
+      for (int c = 0; c < 4; c++) dst[c] = (uint8_t) ((sums[c] * reciprocal) >> 32);
+    }
+  }
+}
+
+} // namespace CS248
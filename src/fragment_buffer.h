@@ -0,0 +1,106 @@
+#ifndef CS248_FRAGMENT_BUFFER_H
+#define CS248_FRAGMENT_BUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "aligned_buffer.h"
+
+namespace CS248 {
+
+struct Premultiplied;
+
+// A sample buffer that stores each pixel as up to two fragments, a color
+// and the mask of the samples that hold it, instead of one color per
+// sample. Pixels inside a shape or between shapes hold a single color and
+// pixels on an edge two, so a pixel takes 12 bytes whatever the sample
+// rate. The rare pixel where three or more colors meet is expanded into a
+// full set of samples. Samples are premultiplied RGBA8 like the planes of
+// the uncompressed buffer, and sample s of a pixel corresponds to plane s.
+class FragmentBuffer {
+ public:
+
+  // most samples per pixel a coverage mask holds
+  static const size_t kMaxSamples = 31;
+
+  FragmentBuffer() : pixels(NULL), width(0), height(0), samples(0), all(0) { }
+
+  // size the buffer to width x height pixels of samples each, keeping its
+  // memory. The pixels are undefined until cleared from the first sample,
+  // an empty size releases the memory
+  void resize( size_t width, size_t height, size_t samples );
+
+  // set samples [begin, end) of the pixels [x0, x1) of row y to white. The
+  // samples past end are left undefined when begin is 0
+  void clear( int x0, int x1, int y, size_t begin, size_t end );
+
+  // free the samples of expanded pixels, once clearing from the first
+  // sample has left none
+  void drop_expanded() { expanded.clear(); }
+
+  // copy sample s of the pixels [x0, x1) of row y to or from consecutive
+  // RGBA8 values
+  void load( int x0, int x1, int y, size_t s, unsigned char* rgba ) const;
+  void store( int x0, int x1, int y, size_t s, const unsigned char* rgba );
+
+  // set sample s of the pixels [x0, x1) of row y to a single color
+  void fill( int x0, int x1, int y, size_t s, const unsigned char* rgba );
+
+  // set every sample of the pixels [x0, x1) of row y to a color, or blend
+  // a premultiplied color over them, a fragment at a time
+  void fill_pixels( int x0, int x1, int y, const unsigned char* rgba );
+  void blend_pixels( int x0, int x1, int y, const Premultiplied& src,
+                     bool linear );
+
+  // move every pixel by (dx, dy), exposing white
+  void shift( int dx, int dy );
+
+  // average samples [0, count) of the pixels [x0, x1) of row y into dst,
+  // the way average_span or resolve_span_linear would average them as
+  // planes
+  void resolve( unsigned char* dst, int x0, int x1, int y, size_t count,
+                bool linear );
+
+ private:
+
+  // the samples in coverage hold color[1], the others color[0], each an
+  // RGBA8 sample as it lies in memory. An expanded pixel has kExpanded set
+  // and the index of its samples in expanded below it
+  struct Pixel {
+    uint32_t color[2];
+    uint32_t coverage;
+  };
+  static const uint32_t kExpanded = 0x80000000;
+
+  // width x height pixels in the memory of storage
+  Pixel* pixels;
+  AlignedBuffer storage;
+
+  // samples of the expanded pixels, a run of 4 * samples bytes each
+  std::vector<unsigned char> expanded;
+
+  size_t width, height, samples;
+
+  // the mask of all samples
+  uint32_t all;
+
+  Pixel& at( int x, int y ) { return pixels[x + y * width]; }
+  const Pixel& at( int x, int y ) const { return pixels[x + y * width]; }
+
+  const unsigned char* sample( const Pixel& p, size_t s ) const {
+    if (p.coverage & kExpanded) {
+      return &expanded[4 * (samples * (p.coverage & ~kExpanded) + s)];
+    }
+    return (const unsigned char*) &p.color[(p.coverage >> s) & 1];
+  }
+
+  void set( Pixel& p, size_t s, uint32_t rgba );
+
+  // give a pixel a full set of samples
+  void expand( Pixel& p );
+};
+
+} // namespace CS248
+
+#endif // CS248_FRAGMENT_BUFFER_H
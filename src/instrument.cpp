@@ -0,0 +1,86 @@
+#include "instrument.h"
+
+#include <cstdio>
+#include <sstream>
+#include <iomanip>
+
+using namespace std;
+
+namespace CS248 {
+
+// a frame of a dense file at 4x4 SSAA stays well below this
+static const size_t kMaxTraceEvents = 1 << 20;
+
+// counts like 1234567 as 1.2M for the osd
+static string abbreviate( size_t n ) {
+
+  ostringstream s;
+  s << fixed << setprecision(1);
+  if (n >= 1000000) s << n / 1e6 << "M";
+  else if (n >= 1000) s << n / 1e3 << "k";
+  else s << n;
+  return s.str();
+}
+
+Instrumentation::Instrumentation()
+  : dropped(0), origin(chrono::steady_clock::now()) {
+  begin_frame();
+}
+
+void Instrumentation::begin_frame() {
+
+  counters = RenderCounters();
+  events.clear();
+  dropped = 0;
+}
+
+double Instrumentation::now() const {
+  return chrono::duration<double, micro>(chrono::steady_clock::now() - origin).count();
+}
+
+void Instrumentation::add_event( const char* name, double begin, double end ) {
+
+  if (events.size() >= kMaxTraceEvents) {
+    dropped++;
+    return;
+  }
+
+  Event e = { name, begin, end - begin };
+  events.push_back(e);
+}
+
+bool Instrumentation::write_trace( const string& path ) const {
+
+  FILE* file = fopen(path.c_str(), "w");
+  if (!file) return false;
+
+  fprintf(file, "{\"traceEvents\":[\n");
+  for (size_t i = 0; i < events.size(); i++) {
+    const Event& e = events[i];
+    fprintf(file, "%s{\"name\":\"%s\",\"cat\":\"drawsvg\",\"ph\":\"X\","
+                  "\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1}",
+            i ? ",\n" : "", e.name, e.begin, e.duration);
+  }
+
+  // counters of the frame as metadata, shown under the trace's info
+  fprintf(file, "\n],\"otherData\":{\"primitives\":%zu,\"samples_tested\":%zu,"
+                "\"samples_covered\":%zu,\"blends\":%zu,\"pixels_resolved\":%zu,"
+                "\"dropped_events\":%zu}}\n",
+          counters.primitives, counters.samples_tested, counters.samples_covered,
+          counters.blends, counters.pixels_resolved, dropped);
+
+  return fclose(file) == 0;
+}
+
+string Instrumentation::summary() const {
+
+  ostringstream s;
+  s << abbreviate(counters.primitives) << " prims, "
+    << abbreviate(counters.samples_covered) << "/"
+    << abbreviate(counters.samples_tested) << " samples covered, "
+    << abbreviate(counters.blends) << " blends, "
+    << abbreviate(counters.pixels_resolved) << " px resolved";
+  return s.str();
+}
+
+} // namespace CS248
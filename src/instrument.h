@@ -0,0 +1,93 @@
+#ifndef CS248_INSTRUMENT_H
+#define CS248_INSTRUMENT_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+
+namespace CS248 {
+
+// Instrumentation of SoftwareRendererImp: counters and a trace of timed
+// scopes for the last frame drawn. It is compiled in with
+// -DDRAWSVG_INSTRUMENT (cmake -DBUILD_INSTRUMENTED=ON), otherwise the
+// INSTRUMENT_* macros expand to nothing and the hot paths are untouched.
+
+#ifdef DRAWSVG_INSTRUMENT
+static const bool kInstrumented = true;
+#else
+static const bool kInstrumented = false;
+#endif
+
+struct RenderCounters {
+  size_t primitives;        // elements drawn, groups not included
+  size_t samples_tested;    // triangle coverage tests
+  size_t samples_covered;   // tests that found the sample inside
+  size_t blends;            // samples blended into the sample buffer
+  size_t pixels_resolved;
+};
+
+class Instrumentation {
+ public:
+
+  Instrumentation();
+
+  // forget the counters and trace of the previous frame
+  void begin_frame();
+
+  // microseconds since the instrumentation was created
+  double now() const;
+
+  // a completed scope, dropped once the trace of a frame is full
+  void add_event( const char* name, double begin, double end );
+
+  // write the trace of the last frame as chrome trace_event json, which
+  // chrome://tracing and ui.perfetto.dev open. false if it can't be written
+  bool write_trace( const std::string& path ) const;
+
+  // one line summary of the counters, for the viewer osd
+  std::string summary() const;
+
+  RenderCounters counters;
+
+ private:
+
+  struct Event {
+    const char* name;
+    double begin, duration;
+  };
+
+  std::vector<Event> events;
+  size_t dropped;
+  std::chrono::steady_clock::time_point origin;
+
+};
+
+// records the duration of its scope as a trace event
+class TraceScope {
+ public:
+  TraceScope( Instrumentation& instrumentation, const char* name )
+    : instrumentation(instrumentation), name(name),
+      begin(instrumentation.now()) { }
+  ~TraceScope() { instrumentation.add_event(name, begin, instrumentation.now()); }
+ private:
+  Instrumentation& instrumentation;
+  const char* name;
+  double begin;
+};
+
+#ifdef DRAWSVG_INSTRUMENT
+#define INSTRUMENT_BEGIN_FRAME(inst) ((inst).begin_frame())
+#define INSTRUMENT_COUNT(inst, counter, n) ((inst).counters.counter += (n))
+#define INSTRUMENT_SCOPE_NAME(line) instrument_scope_##line
+#define INSTRUMENT_SCOPE_AT(inst, name, line) \
+  TraceScope INSTRUMENT_SCOPE_NAME(line)((inst), (name))
+#define INSTRUMENT_SCOPE(inst, name) INSTRUMENT_SCOPE_AT(inst, name, __LINE__)
+#else
+#define INSTRUMENT_BEGIN_FRAME(inst) ((void) 0)
+#define INSTRUMENT_COUNT(inst, counter, n) ((void) 0)
+#define INSTRUMENT_SCOPE(inst, name) ((void) 0)
+#endif
+
+} // namespace CS248
+
+#endif // CS248_INSTRUMENT_H
@@ -38,7 +38,7 @@ int loadDirectory( DrawSVG* drawsvg, const char* path ) {
 
       string filename = ent->d_name;
       string filesufx = filename.substr(filename.find_last_of(".") + 1);
-      if (filesufx == "svg" ) {
+      if (filesufx == "svg" || filesufx == "svgb") {
         cerr << "[DrawSVG] Loading " << filename << "... "; 
         if (loadFile(drawsvg, (pathname + filename).c_str()) < 0) {
           cerr << "Failed (Invalid SVG file)" << endl;
@@ -88,8 +88,45 @@ int loadPath( DrawSVG* drawsvg, const char* path) {
   return -1;
 }
 
+void decodeTextures( vector<SVGElement*>& elements ) {
+
+  for (size_t i = 0; i < elements.size(); ++i) {
+    if (elements[i]->type == IMAGE) {
+      decode_texture(static_cast<Image*>(elements[i])->tex);
+    } else if (elements[i]->type == GROUP) {
+      decodeTextures(static_cast<Group*>(elements[i])->elements);
+    }
+  }
+}
+
+int cacheFile( const char* path, const char* cache_path ) {
+
+  SVG svg;
+
+  if( SVGParser::load( path, &svg ) < 0 ) {
+    msg("Could not load " << path);
+    return -1;
+  }
+
+  // snapshots carry decoded texels so warm loads skip png inflation
+  decodeTextures( svg.elements );
+
+  if( SVGParser::save( cache_path, &svg ) < 0 ) {
+    msg("Could not write " << cache_path);
+    return -1;
+  }
+
+  msg("Wrote snapshot of " << path << " to " << cache_path);
+  return 0;
+}
+
 int main( int argc, char** argv ) {
 
+  // write a binary snapshot and exit
+  if( argc == 4 && string(argv[1]) == "-c" ) {
+    return cacheFile(argv[2], argv[3]) < 0 ? 1 : 0;
+  }
+
   // create viewer
   Viewer viewer = Viewer();
 
@@ -103,7 +140,8 @@ int main( int argc, char** argv ) {
   if( argc == 2 ) {
     if (loadPath(drawsvg, argv[1]) < 0) exit(0);
   } else {
-    msg("Usage: drawsvg <path to test file or directory>"); exit(0);
+    msg("Usage: drawsvg <path to test file or directory>");
+    msg("       drawsvg -c <svg file> <snapshot file>"); exit(0);
   }
 
   // init viewer
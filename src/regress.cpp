@@ -0,0 +1,292 @@
+#include "CS248.h"
+#include "timer.h"
+#include "svg.h"
+#include "texture.h"
+#include "viewport.h"
+#include "software_renderer.h"
+#include "corpus.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+using namespace std;
+using namespace CS248;
+
+#define msg(s) cerr << "[Regress] " << s << endl;
+
+// Renders every svg file under the given paths with both the implementation
+// and the reference renderer, at several sample rates and views, and reports
+// how far the two differ and how long each took. Results can be saved as a
+// baseline, and later runs fail when a case differs more than its baseline
+// or slows down relative to the reference by more than the allowed slack.
+
+struct Options {
+  size_t width, height;
+  vector<size_t> rates;
+  int repeat;
+  double error_slack;      // extra fraction of differing pixels allowed
+  double time_slack;       // extra fraction of the imp/ref time ratio allowed
+  double min_timed_ms;     // faster cases are too noisy to check for time
+  string baseline;
+  string write_baseline;
+};
+
+struct View {
+  const char* name;
+  float cx, cy;            // center as a fraction of the canvas size
+  float zoom;              // relative to the view that fits the canvas
+};
+
+// fit the canvas, zoom into it, and pan it partly out of the window
+static const View kViews[] = {
+  { "fit",  0.5f,  0.5f,  1 },
+  { "zoom", 0.35f, 0.4f,  4 },
+  { "pan",  0.75f, 0.65f, 1 },
+};
+
+struct Result {
+  double error;             // fraction of pixels that differ
+  double psnr;              // over the rgb channels, infinite if identical
+  double imp_ms, ref_ms;
+};
+
+static void usage() {
+  msg("Usage: drawsvg_regress [options] <svg file or directory> ...");
+  msg("  -s <w>x<h>      frame size (default 400x300)");
+  msg("  -r <rates>      comma separated sample rates (default 1,2,4)");
+  msg("  -n <count>      timed runs per case, the best counts (default 3)");
+  msg("  -b <file>       compare against a baseline");
+  msg("  -w <file>       write the results as a new baseline");
+  msg("  -e <fraction>   differing pixels allowed over the baseline (default 0.002)");
+  msg("  -t <fraction>   slowdown allowed over the baseline (default 1.0)");
+}
+
+// best time of a few runs, in milliseconds
+static double draw( SoftwareRenderer* renderer, SVG& svg, int repeat ) {
+
+  double best = INF_D;
+  for (int i = 0; i < repeat; i++) {
+    Timer timer;
+    timer.start();
+    renderer->clear_buffer();
+    renderer->draw_svg(svg);
+    timer.stop();
+    best = min(best, timer.duration() * 1000);
+  }
+
+  return best;
+}
+
+static Result compare( const vector<unsigned char>& imp,
+                       const vector<unsigned char>& ref ) {
+
+  size_t n = imp.size() / 4, errors = 0;
+  double squared_error = 0;
+  for (size_t i = 0; i < n; i++) {
+    int r = imp[i*4 + 0] - ref[i*4 + 0];
+    int g = imp[i*4 + 1] - ref[i*4 + 1];
+    int b = imp[i*4 + 2] - ref[i*4 + 2];
+    squared_error += r * r + g * g + b * b;
+    errors += (r | g | b) != 0;
+  }
+
+  Result result;
+  result.error = (double) errors / n;
+  result.psnr = squared_error > 0 ?
+                10 * log10(255.0 * 255.0 * 3 * n / squared_error) : INF_D;
+  return result;
+}
+
+// directory of a path, with a trailing slash
+static string directory( const string& path ) {
+
+  size_t slash = path.find_last_of('/');
+  return slash == string::npos ? "" : path.substr(0, slash + 1);
+}
+
+static bool load_baseline( const string& path, map<string, Result>& baseline ) {
+
+  ifstream in(path.c_str());
+  if (!in) return false;
+
+  string line;
+  while (getline(in, line)) {
+    if (line.empty() || line[0] == '#') continue;
+    istringstream fields(line);
+    string key; Result r;
+    if (fields >> key >> r.error >> r.psnr >> r.imp_ms >> r.ref_ms) {
+      baseline[key] = r;
+    }
+  }
+
+  return true;
+}
+
+int main( int argc, char** argv ) {
+
+  Options options;
+  options.width = 400; options.height = 300;
+  options.repeat = 3;
+  options.error_slack = 0.002;
+  options.time_slack = 1.0;
+  options.min_timed_ms = 2;
+
+  vector<string> paths;
+  string rates = "1,2,4";
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "-s" && has_value) {
+      if (sscanf(argv[++i], "%zux%zu", &options.width, &options.height) != 2) {
+        usage(); return 1;
+      }
+    }
+    else if (arg == "-r" && has_value) rates = argv[++i];
+    else if (arg == "-n" && has_value) options.repeat = max(1, atoi(argv[++i]));
+    else if (arg == "-b" && has_value) options.baseline = argv[++i];
+    else if (arg == "-w" && has_value) options.write_baseline = argv[++i];
+    else if (arg == "-e" && has_value) options.error_slack = atof(argv[++i]);
+    else if (arg == "-t" && has_value) options.time_slack = atof(argv[++i]);
+    else if (arg[0] == '-') { usage(); return 1; }
+    else paths.push_back(arg);
+  }
+
+  istringstream rate_list(rates);
+  for (string rate; getline(rate_list, rate, ','); ) {
+    if (atoi(rate.c_str()) > 0) options.rates.push_back(atoi(rate.c_str()));
+  }
+
+  if (paths.empty() || options.rates.empty()) {
+    usage(); return 1;
+  }
+
+  map<string, Result> baseline;
+  if (!options.baseline.empty() && !load_baseline(options.baseline, baseline)) {
+    msg("Could not read baseline " << options.baseline);
+    return 1;
+  }
+
+  ofstream out;
+  if (!options.write_baseline.empty()) {
+    out.open(options.write_baseline.c_str());
+    if (!out) {
+      msg("Could not write baseline " << options.write_baseline);
+      return 1;
+    }
+    out << "# case error psnr imp_ms ref_ms" << endl;
+  }
+
+  // renderers draw into their own buffers so the frames can be compared
+  size_t w = options.width, h = options.height;
+  vector<unsigned char> imp_pixels(4 * w * h), ref_pixels(4 * w * h);
+
+  SoftwareRendererRef* ref = new SoftwareRendererRef(16);
+  SoftwareRendererImp* imp = new SoftwareRendererImp(ref);
+  Sampler2DImp imp_sampler; Sampler2DRef ref_sampler;
+  imp->set_tex_sampler(&imp_sampler); ref->set_tex_sampler(&ref_sampler);
+  imp->set_pixel_buffer(&imp_pixels[0], w, h);
+  ref->set_pixel_buffer(&ref_pixels[0], w, h);
+
+  // cases are named relative to the baseline, so a run over part of the
+  // files still finds them, or else to the path they were found under
+  string baseline_dir = directory(options.baseline.empty() ?
+                                  options.write_baseline : options.baseline);
+
+  size_t cases = 0, failures = 0, missing = 0;
+  for (size_t p = 0; p < paths.size(); p++) {
+
+    vector<string> files;
+    find_svg_files(paths[p], files);
+
+    string root = paths[p];
+    if (root.back() != '/') root.push_back('/');
+    if (!baseline_dir.empty() && !root.compare(0, baseline_dir.size(), baseline_dir)) {
+      root = baseline_dir;
+    }
+
+    for (size_t f = 0; f < files.size(); f++) {
+
+      string name = files[f].compare(0, root.size(), root) ?
+                    files[f] : files[f].substr(root.size());
+
+      SVG svg;
+      if (SVGParser::load(files[f].c_str(), &svg) < 0) {
+        msg("Could not load " << files[f]);
+        failures++;
+        continue;
+      }
+      decode_textures(svg.elements);
+      generate_mipmaps(svg.elements, &imp_sampler);
+
+      for (size_t v = 0; v < sizeof(kViews) / sizeof(kViews[0]); v++) {
+
+        ViewportImp imp_viewport; ViewportRef ref_viewport;
+        const View& view = kViews[v];
+        imp->set_canvas_to_screen(view_transform(imp_viewport, svg, view.cx, view.cy,
+                                                 view.zoom, w, h));
+        ref->set_canvas_to_screen(view_transform(ref_viewport, svg, view.cx, view.cy,
+                                                 view.zoom, w, h));
+
+        for (size_t s = 0; s < options.rates.size(); s++) {
+
+          imp->set_sample_rate(options.rates[s]);
+          ref->set_sample_rate(options.rates[s]);
+
+          double imp_ms = draw(imp, svg, options.repeat);
+          double ref_ms = draw(ref, svg, options.repeat);
+
+          Result result = compare(imp_pixels, ref_pixels);
+          result.imp_ms = imp_ms; result.ref_ms = ref_ms;
+
+          string key = name + ":" + kViews[v].name + ":" + to_string(options.rates[s]);
+          cases++;
+
+          // regressions against the baseline, if it knows this case
+          string failure;
+          map<string, Result>::iterator base = baseline.find(key);
+          if (base == baseline.end()) {
+            if (!baseline.empty()) missing++;
+          } else {
+            const Result& b = base->second;
+            if (result.error > b.error + options.error_slack) {
+              failure = "error";
+            }
+            if (result.imp_ms >= options.min_timed_ms && b.ref_ms > 0 &&
+                result.imp_ms / result.ref_ms >
+                b.imp_ms / b.ref_ms * (1 + options.time_slack)) {
+              failure += failure.empty() ? "time" : ", time";
+            }
+          }
+
+          if (!failure.empty()) failures++;
+
+          printf("%-48s %6.3f%% psnr %6.2f  imp %8.2f ms  ref %8.2f ms  %5.2fx%s\n",
+                 key.c_str(), result.error * 100, min(result.psnr, 99.99),
+                 result.imp_ms, result.ref_ms, result.imp_ms / result.ref_ms,
+                 failure.empty() ? "" : ("  FAIL (" + failure + ")").c_str());
+          fflush(stdout);
+
+          if (out) {
+            out << key << " " << result.error << " " << min(result.psnr, 99.99)
+                << " " << result.imp_ms << " " << result.ref_ms << endl;
+          }
+        }
+      }
+    }
+  }
+
+  delete imp;
+  delete ref;
+
+  msg(cases << " cases, " << failures << " failed" <<
+      (missing ? ", " + to_string(missing) + " not in baseline" : ""));
+  return failures ? 1 : 0;
+}
@@ -2,8 +2,9 @@
 #define CS248_SOFTWARE_RENDERER_H
 
 #include <stdio.h>
-#include <vector>
 #include <queue>
+#include <vector>
+#include <atomic>
 
 #ifdef USE_PTHREAD
 #define HAVE_STRUCT_TIMESPEC
@@ -13,6 +14,11 @@
 #include "CS248.h"
 #include "texture.h"
 #include "svg_renderer.h"
+#include "instrument.h"
+#include "composite.h"
+#include "fragment_buffer.h"
+#include "aligned_buffer.h"
+#include "coverage.h"
 
 namespace CS248 { // CS248
 
@@ -23,6 +29,14 @@ double Initialize_Timer();
 
 class SoftwareRendererRef;
 
+// seconds spent in each stage of drawing, added up while set on a renderer
+// (see SoftwareRendererImp::set_stage_times). draw covers all element
+// drawing including triangulation and rasterization, the rest of it goes to
+// transforms, culling and detail selection
+struct StageTimes {
+  double clear, draw, triangulate, rasterize, resolve;
+};
+
 class SoftwareRenderer : public SVGRenderer {
  public:
 
@@ -84,11 +98,85 @@ public:
 
 	SoftwareRendererImp(SoftwareRendererRef *ref = NULL) : SoftwareRenderer(), ref(ref) {
     sample_buffer = NULL;
+    target.samples = NULL;
+    sample_order.assign(1, 0);
+    sample_begin = 0; sample_end = 1;
+    dirty_x = 0;
+    cancel = NULL;
+    clip_x0 = clip_y0 = clip_x1 = clip_y1 = 0;
+    stage_times = NULL;
+    occlusion_culling = recording = replaying = false;
+    linear_light = false;
+    compressed = fragmented = false;
+    analytic = false;
   }
 
 	// draw an svg input to pixel buffer
 	void draw_svg(SVG& svg);
 
+	// progressive drawing: draws a single sample per pixel and returns
+	// true if refine_svg can add the remaining samples
+	bool draw_svg_progressive(SVG& svg);
+
+	// draw the next sample plane of a progressive drawing, keeping the
+	// samples drawn so far. returns true while samples remain
+	bool refine_svg(SVG& svg);
+
+	// true while a progressive drawing has samples left to refine
+	bool refining() const {
+		return !analytic && sample_end < sample_rate * sample_rate;
+	}
+
+	// pan the last drawing by whole pixels under the current
+	// canvas_to_screen, reusing its samples and only drawing the newly
+	// exposed strips. returns false if the last drawing can not be reused
+	bool scroll_svg(SVG& svg, int dx, int dy);
+
+	// drawing stops early, leaving a partial frame, once *cancel is set
+	void set_cancel_flag(const std::atomic<bool>* cancel) {
+		this->cancel = cancel;
+	}
+
+	// add the time spent in each stage to *times, NULL to stop timing
+	void set_stage_times(StageTimes* times) {
+		this->stage_times = times;
+	}
+
+	// counters and trace of the last frame, only updated when built with
+	// DRAWSVG_INSTRUMENT (see instrument.h)
+	const Instrumentation& get_instrumentation() const {
+		return instrumentation;
+	}
+
+	// draw the opaque primitives of a frame front to back, skipping samples
+	// and whole primitives hidden by opaque ones drawn over them, then the
+	// translucent ones back to front. the result is the same either way
+	void set_occlusion_culling(bool enabled) {
+		this->occlusion_culling = enabled;
+	}
+
+	// blend and resolve in linear light instead of on sRGB encoded values,
+	// through lookup tables (see composite.h)
+	void set_linear_light(bool enabled) {
+		this->linear_light = enabled;
+	}
+
+	// anti-alias with the exact area each shape covers in a pixel instead
+	// of with samples: fills are drawn from their outlines through a
+	// CoverageRaster (see coverage.h) into a single sample per pixel,
+	// whatever the sample rate. Lines, points and images take that sample
+	// as they are
+	void set_analytic_coverage(bool enabled) {
+		// the planes one mode leaves alone keep what the other drew
+		if (enabled != analytic) dirty_tiles.assign(dirty_tiles.size(), 1);
+		this->analytic = enabled;
+	}
+
+	// keep the samples of each pixel as fragments with coverage masks (see
+	// fragment_buffer.h) instead of a plane per sample, for sample rates of
+	// up to kMaxSamples samples per pixel. The result is the same either way
+	void set_compressed_samples(bool enabled);
+
 	// set sample rate
 	void set_sample_rate(size_t sample_rate);
 
@@ -98,10 +186,179 @@ public:
 
 	void fill_sample(int sx, int sy, int sb, const Color& color);
 	void fill_pixel(int x, int y, const Color& color);
+	void fill_span(int x0, int x1, int y, size_t sb, const Premultiplied& src);
+	void fill_pixels(int x0, int x1, int y, const Premultiplied& src);
+
+	// a primitive recorded for occlusion culling, in screen space
+	struct DrawCommand {
+		enum Kind { POINT, LINE, TRIANGLE, IMAGE } kind;
+		float x0, y0, x1, y1, x2, y2;
+		Color color;
+		Texture* tex;
+	};
 
 private:
-  // Sample buffer for supersampling
+  // Sample buffer for supersampling, one plane of width x height
+  // pixels per sample, in the memory of planes
   unsigned char* sample_buffer;
+  AlignedBuffer planes;
+
+  // the samples instead, while compressed samples are on and the sample
+  // rate allows
+  bool compressed, fragmented;
+  FragmentBuffer fragments;
+
+  // size the sample buffer or the fragments for the pixel buffer and
+  // sample rate, reusing their memory. The samples are undefined until a
+  // pass clears them, so nothing counts as drawn
+  void allocate_samples();
+
+  // sample (bx + by * sample_rate) stored in each sample plane, ordered
+  // so that the first planes spread out over the pixel
+  std::vector<size_t> sample_order;
+
+  // sample planes rasterized by the current pass
+  size_t sample_begin, sample_end;
+
+  // per tile of the frame, set where some plane may hold samples that are
+  // not white, and where the frame being drawn has drawn so far. Passes
+  // only clear and resolve the dirty tiles
+  std::vector<unsigned char> dirty_tiles, drawn_tiles;
+  size_t dirty_x;
+
+  // mark the tiles of the pixels [floor(x0), floor(x1)] x
+  // [floor(y0), floor(y1)] in the clip rectangle as drawn
+  void mark_drawn(float x0, float y0, float x1, float y1);
+
+  // set planes [begin, end) of the dirty tiles to white
+  void clear_dirty(size_t begin, size_t end);
+
+  // where fill_sample and fill_span store samples: the sample buffer, or
+  // the layer of a group, covering [x0, x0 + w) x [y0, y0 + h) of the
+  // planes from first_plane on. NULL samples stand for the fragments
+  struct SampleTarget {
+    unsigned char* samples;
+    int x0, y0;
+    size_t w, h, first_plane;
+  };
+  SampleTarget target;
+
+  unsigned char* sample_at(int x, int y, size_t sb) {
+    return target.samples + 4 * ((x - target.x0) + (y - target.y0) * target.w) +
+           4 * target.w * target.h * (sb - target.first_plane);
+  }
+
+  // samples [x0, x1) of row y of plane sb of the target, to be changed in
+  // place and handed back with store_span. Fragments are copied through
+  // span_samples
+  unsigned char* load_span(int x0, int x1, int y, size_t sb) {
+    if (target.samples) return sample_at(x0, y, sb);
+    fragments.load(x0, x1, y, sb, &span_samples[0]);
+    return &span_samples[0];
+  }
+  void store_span(int x0, int x1, int y, size_t sb) {
+    if (!target.samples) fragments.store(x0, x1, y, sb, &span_samples[0]);
+  }
+  std::vector<unsigned char> span_samples;
+
+  // true if whole pixels can be filled at once, with every sample of the
+  // fragments being drawn and nothing to test them against
+  bool whole_pixels() const {
+    return !target.samples && !replaying && sample_begin == 0 &&
+           sample_end == sample_rate * sample_rate;
+  }
+
+  // per plane, the ends of the samples a triangle covers in a row
+  std::vector<int> runs;
+
+  // draw to the sample buffer
+  void target_frame();
+
+  // buffers of the layers of groups with opacity or a blend mode
+  LayerPool layers;
+
+  // blend and resolve in linear light
+  bool linear_light;
+
+  // fill shapes by their coverage of a single sample per pixel
+  bool analytic;
+  CoverageRaster coverage;
+  std::vector<Vector2D> outline;
+
+  // abandon the current drawing when set
+  const std::atomic<bool>* cancel;
+
+  // pixels outside [clip_x0, clip_x1) x [clip_y0, clip_y1) are left alone
+  int clip_x0, clip_y0, clip_x1, clip_y1;
+
+  // stage totals being timed, if any
+  StageTimes* stage_times;
+  double* stage(double StageTimes::*total) {
+    return stage_times ? &(stage_times->*total) : NULL;
+  }
+
+  // counters and timed scopes of the current frame
+  Instrumentation instrumentation;
+
+  // rasterize_* record their primitives instead while recording, which
+  // replay then draws in occlusion order
+  bool occlusion_culling, recording;
+  std::vector<DrawCommand> commands;
+
+  // while replaying, the index of the command being drawn and whether the
+  // opaque ones are being drawn front to back
+  bool replaying, front_to_back;
+  uint32_t current_command;
+
+  // per sample of the current planes, pixel by pixel, 1 + the index of the
+  // front most opaque command covering it, or 0
+  std::vector<uint32_t> depth;
+
+  // per tile of pixels, the samples covered by opaque commands and the
+  // smallest depth among them
+  std::vector<uint32_t> tile_covered, tile_depth;
+  size_t tiles_x;
+
+  // draw the recorded commands, false if cancelled
+  bool replay();
+  void execute(const DrawCommand& command);
+
+  // true if every sample a command may touch is hidden
+  bool occluded(const DrawCommand& command);
+
+  // true if the opaque samples of the pixels [x0, x1] of row y are all
+  // filled, with both ends in the clip rectangle
+  bool row_occluded(int x0, int x1, int y);
+
+  // depth test of a sample while replaying, true if it is to be drawn
+  bool depth_test(int sx, int sy, size_t sb);
+
+  // draw sample planes [begin, end) and resolve the planes [0, end)
+  void draw_samples(SVG& svg, size_t begin, size_t end);
+
+  // draw and resolve the pixels in a rectangle of the current planes
+  bool draw_strip(SVG& svg, int x0, int y0, int x1, int y1);
+
+  // draw all elements and the canvas outline, false if cancelled
+  bool draw_scene(SVG& svg);
+
+  // draw a list of elements in order, skipping those outside the clip
+  // rectangle, false if cancelled
+  bool draw_elements(const std::vector<SVGElement*>& elements,
+                     const std::vector<BBox>& bounds, const BoundsGrid& grid);
+
+  // true if bounds in the current coordinate space may reach the clip
+  // rectangle on screen
+  bool visible(const BBox& bounds);
+
+  // the clip rectangle mapped back into the current coordinate space,
+  // false if it can not be bounded there
+  bool clip_bounds(BBox& region);
+
+  // the coarsest copy of an outline that stays within a fraction of a
+  // sample of it on screen
+  const std::vector<Vector2D>& detail_level(const std::vector<Vector2D>& points,
+                                            const std::vector<Simplified>& detail);
 
 	// Primitive Drawing //
 
@@ -153,11 +410,16 @@ private:
 		float x1, float y1,
 		Texture& tex);
 
-	// resolve samples to pixel buffer
+	// rasterize the inside of a closed outline by its coverage
+	void rasterize_polygon(const std::vector<Vector2D>& points,
+		Color color);
+
+	// resolve samples to pixel buffer, the dirty tiles of the clip
+	// rectangle. The others are white
 	void resolve(void);
 
-	// task5 alpha compositing
-	Color alpha_blending(Color pixel_color, Color color);
+	// resolve the pixels [x0, x1) of the rows [y0, y1)
+	void resolve_rect(int x0, int y0, int x1, int y1);
 
 	SoftwareRendererRef *ref;
 }; // class SoftwareRendererImp
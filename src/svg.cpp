@@ -3,11 +3,19 @@
 #include "base64.h"
 
 #include <string>
+#include <cstring>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <algorithm>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 using namespace std;
 
 namespace CS248 {
@@ -24,15 +32,1011 @@ SVG::~SVG() {
   } elements.clear();
 }
 
+// Interning //
+
+// byte-wise orderings, both types are plain arrays of floats / doubles
+struct StyleLess {
+  bool operator()( const Style& a, const Style& b ) const {
+    return memcmp( &a, &b, sizeof(Style) ) < 0;
+  }
+};
+
+struct TransformLess {
+  bool operator()( const Matrix3x3& a, const Matrix3x3& b ) const {
+    return memcmp( &a, &b, sizeof(Matrix3x3) ) < 0;
+  }
+};
+
+struct InternTables {
+  SVG* svg;
+  map<Style, uint16_t, StyleLess> style_ids;
+  map<Matrix3x3, uint16_t, TransformLess> transform_ids;
+};
+
+static void intern_elements( const vector<SVGElement*>& elements,
+                             InternTables& tables ) {
+
+  SVG* svg = tables.svg;
+  for (size_t i = 0; i < elements.size(); i++) {
+
+    SVGElement* element = elements[i];
+
+    // ids are 16 bit, documents with more distinct entries than that keep
+    // the remaining elements un-interned and draw from their own copies
+    map<Style, uint16_t, StyleLess>::iterator s =
+      tables.style_ids.find( element->style );
+    if ( s != tables.style_ids.end() ) {
+      element->style_id = s->second;
+    } else if ( svg->styles.size() < kNotInterned ) {
+      element->style_id = svg->styles.size();
+      tables.style_ids[element->style] = element->style_id;
+      svg->styles.push_back( element->style );
+    }
+
+    map<Matrix3x3, uint16_t, TransformLess>::iterator t =
+      tables.transform_ids.find( element->transform );
+    if ( t != tables.transform_ids.end() ) {
+      element->transform_id = t->second;
+    } else if ( svg->transforms.size() < kNotInterned ) {
+      element->transform_id = svg->transforms.size();
+      tables.transform_ids[element->transform] = element->transform_id;
+      svg->transforms.push_back( element->transform );
+    }
+
+    if ( element->type == GROUP ) {
+      intern_elements( static_cast<Group*>(element)->elements, tables );
+    }
+  }
+}
+
+void SVGParser::intern( SVG* svg ) {
+
+  InternTables tables;
+  tables.svg = svg;
+
+  svg->styles.clear();
+  svg->transforms.clear();
+
+  // slot 0 is always the identity so the renderer can skip it cheaply
+  svg->transforms.push_back( Matrix3x3::identity() );
+  tables.transform_ids[svg->transforms[0]] = kIdentityTransform;
+
+  intern_elements( svg->elements, tables );
+}
+
+// Bounds //
+
+// bounds of a box after a (possibly projective) transform
+static BBox transform_bounds( const BBox& b, const Matrix3x3& m ) {
+
+  BBox result;
+  if ( b.empty() ) return result;
+
+  for ( int k = 0; k < 4; k++ ) {
+    Vector3D p = m * Vector3D( k & 1 ? b.max.x : b.min.x,
+                               k & 2 ? b.max.y : b.min.y, 1 );
+    result.expand( Vector2D( p.x / p.z, p.y / p.z ) );
+  }
+
+  return result;
+}
+
+// bounds of the geometry of an element in its own coordinate space
+static BBox local_bounds( SVGElement* element ) {
+
+  BBox b;
+  switch ( element->type ) {
+    case POINT:
+      b.expand( static_cast<Point*>(element)->position );
+      break;
+    case LINE:
+      b.expand( static_cast<Line*>(element)->from );
+      b.expand( static_cast<Line*>(element)->to );
+      break;
+    case POLYLINE: {
+      const vector<Vector2D>& points = static_cast<Polyline*>(element)->points;
+      for ( size_t i = 0; i < points.size(); i++ ) b.expand( points[i] );
+      break;
+    }
+    case RECT: {
+      Rect* rect = static_cast<Rect*>(element);
+      b.expand( rect->position );
+      b.expand( rect->position + rect->dimension );
+      break;
+    }
+    case POLYGON: {
+      const vector<Vector2D>& points = static_cast<Polygon*>(element)->points;
+      for ( size_t i = 0; i < points.size(); i++ ) b.expand( points[i] );
+      break;
+    }
+    case ELLIPSE: {
+      Ellipse* ellipse = static_cast<Ellipse*>(element);
+      b.expand( ellipse->center - ellipse->radius );
+      b.expand( ellipse->center + ellipse->radius );
+      break;
+    }
+    case IMAGE: {
+      Image* image = static_cast<Image*>(element);
+      b.expand( image->position );
+      b.expand( image->position + image->dimension );
+      break;
+    }
+    case GROUP: {
+      const vector<BBox>& bounds = static_cast<Group*>(element)->bounds;
+      for ( size_t i = 0; i < bounds.size(); i++ ) b.expand( bounds[i] );
+      break;
+    }
+    default:
+      break;
+  }
+
+  return b;
+}
+
+// bounds of elements in the coordinate space they are listed in, with a
+// grid over them for long lists
+static void bound_elements( const vector<SVGElement*>& elements,
+                            vector<BBox>& bounds, BoundsGrid& grid ) {
+
+  bounds.resize( elements.size() );
+  for ( size_t i = 0; i < elements.size(); i++ ) {
+
+    SVGElement* element = elements[i];
+    if ( element->type == GROUP ) {
+      Group* group = static_cast<Group*>(element);
+      bound_elements( group->elements, group->bounds, group->grid );
+    }
+
+    BBox b = local_bounds( element );
+    bounds[i] = element->transform_id == kIdentityTransform ?
+                b : transform_bounds( b, element->transform );
+  }
+
+  grid.build( bounds );
+}
+
+void SVGParser::computeBounds( SVG* svg ) {
+
+  bound_elements( svg->elements, svg->bounds, svg->grid );
+}
+
+// Level of detail //
+
+// outlines with fewer points are drawn as they are
+static const size_t kMinDetailPoints = 64;
+
+// a level is only kept if it drops at least a quarter of the points of the
+// previous one, tolerances grow by this factor between attempts
+static const double kDetailReduction = 0.75;
+static const double kDetailStep = 2;
+
+// distance from p to the segment ab
+static double segment_distance( const Vector2D& p,
+                                const Vector2D& a, const Vector2D& b ) {
+
+  Vector2D ab = b - a;
+  double len2 = dot( ab, ab );
+  double t = len2 > 0 ? clamp( dot( p - a, ab ) / len2, 0.0, 1.0 ) : 0;
+  return ( p - ( a + t * ab ) ).norm();
+}
+
+// Douglas-Peucker simplification. A closed outline is split at the point
+// farthest from its first one, so both halves keep their end points.
+static void simplify( const vector<Vector2D>& points, bool closed,
+                      double tolerance, vector<Vector2D>& result ) {
+
+  size_t n = points.size();
+  vector<char> keep( n, 0 );
+  vector< pair<size_t, size_t> > spans;
+
+  if ( closed ) {
+    size_t far = 0;
+    double far_dist = -1;
+    for ( size_t i = 1; i < n; i++ ) {
+      double d = ( points[i] - points[0] ).norm();
+      if ( d > far_dist ) { far = i; far_dist = d; }
+    }
+    keep[0] = keep[far] = 1;
+    spans.push_back( make_pair( (size_t) 0, far ) );
+    spans.push_back( make_pair( far, n ) );
+  } else {
+    keep[0] = keep[n - 1] = 1;
+    spans.push_back( make_pair( (size_t) 0, n - 1 ) );
+  }
+
+  // index n stands for the first point again when closed
+  while ( !spans.empty() ) {
+    size_t first = spans.back().first, last = spans.back().second;
+    spans.pop_back();
+
+    const Vector2D& a = points[first];
+    const Vector2D& b = points[last % n];
+
+    size_t worst = first;
+    double worst_dist = tolerance;
+    for ( size_t i = first + 1; i < last; i++ ) {
+      double d = segment_distance( points[i], a, b );
+      if ( d > worst_dist ) { worst = i; worst_dist = d; }
+    }
+
+    if ( worst != first ) {
+      keep[worst] = 1;
+      spans.push_back( make_pair( first, worst ) );
+      spans.push_back( make_pair( worst, last ) );
+    }
+  }
+
+  result.clear();
+  for ( size_t i = 0; i < n; i++ ) {
+    if ( keep[i] ) result.push_back( points[i] );
+  }
+}
+
+// simplified copies of an outline at growing tolerances, down to the
+// fewest points that still make a line or polygon
+static void build_detail( const vector<Vector2D>& points, bool closed,
+                          vector<Simplified>& detail ) {
+
+  detail.clear();
+  if ( points.size() < kMinDetailPoints ) return;
+
+  BBox b;
+  for ( size_t i = 0; i < points.size(); i++ ) b.expand( points[i] );
+  double size = max( b.max.x - b.min.x, b.max.y - b.min.y );
+  if ( !( size > 0 ) ) return;
+
+  size_t minimum = closed ? 3 : 2;
+  size_t count = points.size();
+  for ( double tolerance = size / 4096; count > minimum && tolerance < size;
+        tolerance *= kDetailStep ) {
+
+    Simplified level;
+    level.tolerance = tolerance;
+    simplify( points, closed, tolerance, level.points );
+
+    if ( level.points.size() < minimum ) break;
+    if ( level.points.size() > count * kDetailReduction ) continue;
+
+    count = level.points.size();
+    detail.push_back( level );
+  }
+}
+
+static void detail_elements( const vector<SVGElement*>& elements ) {
+
+  for ( size_t i = 0; i < elements.size(); i++ ) {
+    SVGElement* element = elements[i];
+    switch ( element->type ) {
+      case POLYLINE: {
+        Polyline* polyline = static_cast<Polyline*>(element);
+        build_detail( polyline->points, false, polyline->detail );
+        break;
+      }
+      case POLYGON: {
+        Polygon* polygon = static_cast<Polygon*>(element);
+        build_detail( polygon->points, true, polygon->detail );
+        break;
+      }
+      case GROUP:
+        detail_elements( static_cast<Group*>(element)->elements );
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+void SVGParser::computeDetail( SVG* svg ) {
+
+  detail_elements( svg->elements );
+}
+
+// Bounds grid //
+
+// lists shorter than this are cheaper to scan than to index
+static const size_t kMinGridElements = 256;
+
+// average number of elements per cell and cap on cells per side
+static const double kGridOccupancy = 4;
+static const int kMaxGridSide = 512;
+
+void BoundsGrid::build( const vector<BBox>& bounds ) {
+
+  extent = BBox();
+  cols = rows = 0;
+  start.clear();
+  items.clear();
+
+  if ( bounds.size() < kMinGridElements ) return;
+
+  for ( size_t i = 0; i < bounds.size(); i++ ) extent.expand( bounds[i] );
+  if ( extent.empty() ) return;
+
+  // roughly square cells, sized for the requested occupancy
+  double w = max( extent.max.x - extent.min.x, 1e-6 );
+  double h = max( extent.max.y - extent.min.y, 1e-6 );
+  double side = sqrt( w * h * kGridOccupancy / bounds.size() );
+  cols = (int) clamp( ceil( w / side ), 1.0, (double) kMaxGridSide );
+  rows = (int) clamp( ceil( h / side ), 1.0, (double) kMaxGridSide );
+  cell_size = Vector2D( w / cols, h / rows );
+
+  // count, then fill in element order so every cell stays sorted
+  start.assign( cols * rows + 1, 0 );
+  for ( size_t i = 0; i < bounds.size(); i++ ) {
+    if ( bounds[i].empty() ) continue;
+    int x0, y0, x1, y1;
+    cell_range( bounds[i], x0, y0, x1, y1 );
+    for ( int y = y0; y <= y1; y++ )
+      for ( int x = x0; x <= x1; x++ ) start[y * cols + x + 1]++;
+  }
+
+  for ( size_t c = 1; c < start.size(); c++ ) start[c] += start[c - 1];
+
+  items.resize( start.back() );
+  vector<uint32_t> fill( start.begin(), start.end() - 1 );
+  for ( size_t i = 0; i < bounds.size(); i++ ) {
+    if ( bounds[i].empty() ) continue;
+    int x0, y0, x1, y1;
+    cell_range( bounds[i], x0, y0, x1, y1 );
+    for ( int y = y0; y <= y1; y++ )
+      for ( int x = x0; x <= x1; x++ ) items[fill[y * cols + x]++] = i;
+  }
+}
+
+bool BoundsGrid::query( const BBox& region, vector<uint32_t>& result ) const {
+
+  result.clear();
+  if ( start.empty() ) return false;
+  if ( region.empty() || !region.overlaps( extent ) ) return true;
+
+  int x0, y0, x1, y1;
+  cell_range( region, x0, y0, x1, y1 );
+  if ( x0 == 0 && y0 == 0 && x1 == cols - 1 && y1 == rows - 1 ) return false;
+
+  for ( int y = y0; y <= y1; y++ ) {
+    for ( int x = x0; x <= x1; x++ ) {
+      int c = y * cols + x;
+      result.insert( result.end(), items.begin() + start[c],
+                                   items.begin() + start[c + 1] );
+    }
+  }
+
+  // elements spanning several cells show up once per cell
+  if ( x0 != x1 || y0 != y1 ) {
+    sort( result.begin(), result.end() );
+    result.erase( unique( result.begin(), result.end() ), result.end() );
+  }
+
+  return true;
+}
+
+void BoundsGrid::cell_range( const BBox& b,
+                             int& x0, int& y0, int& x1, int& y1 ) const {
+
+  x0 = (int) clamp( floor( ( b.min.x - extent.min.x ) / cell_size.x ), 0.0, cols - 1.0 );
+  y0 = (int) clamp( floor( ( b.min.y - extent.min.y ) / cell_size.y ), 0.0, rows - 1.0 );
+  x1 = (int) clamp( floor( ( b.max.x - extent.min.x ) / cell_size.x ), 0.0, cols - 1.0 );
+  y1 = (int) clamp( floor( ( b.max.y - extent.min.y ) / cell_size.y ), 0.0, rows - 1.0 );
+}
+
+// Binary snapshot //
+
+/* The snapshot is a flat, native-endian image of the parsed model:
+ *
+ *   SnapshotHeader
+ *   Style     styles    [num_styles]
+ *   Matrix3x3 transforms[num_transforms]
+ *   element records in document order, groups followed by their children
+ *
+ * Every record starts with a SnapshotRecord and its payload is padded to
+ * 8 bytes, so geometry and texels can be copied straight out of a mapped
+ * file. Images store every mip level they had when saved, plus their png
+ * payload if they had not been decoded yet. Groups store their opacity and
+ * blend mode before their children.
+ */
+
+static const char kSnapshotMagic[8] = { 'D','R','A','W','S','V','G','B' };
+static const uint32_t kSnapshotVersion   = 4;
+static const uint32_t kSnapshotByteOrder = 0x01020304;
+
+// record flags
+static const uint8_t kInlineStyle     = 1 << 0;
+static const uint8_t kInlineTransform = 1 << 1;
+
+struct SnapshotHeader {
+  char     magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  float    width;
+  float    height;
+  uint32_t num_styles;
+  uint32_t num_transforms;
+  uint32_t num_elements;
+  uint32_t reserved;
+};
+
+struct SnapshotRecord {
+  uint8_t  type;
+  uint8_t  flags;
+  uint16_t style_id;
+  uint16_t transform_id;
+  uint16_t reserved;
+  uint32_t count;      // points, mip levels or group children
+  uint32_t reserved2;
+};
+
+struct SnapshotWriter {
+
+  vector<unsigned char> bytes;
+
+  void write( const void* data, size_t size ) {
+    const unsigned char* p = (const unsigned char*) data;
+    bytes.insert( bytes.end(), p, p + size );
+  }
+
+  void align() {
+    bytes.resize( (bytes.size() + 7) & ~(size_t) 7, 0 );
+  }
+};
+
+struct SnapshotReader {
+
+  const unsigned char* data;
+  size_t size;
+  size_t offset;
+
+  bool read( void* dst, size_t n ) {
+    if ( n > size - offset ) return false;
+    memcpy( dst, data + offset, n );
+    offset += n;
+    return true;
+  }
+
+  bool align() {
+    offset = (offset + 7) & ~(size_t) 7;
+    return offset <= size;
+  }
+};
+
+static void save_elements( const vector<SVGElement*>& elements,
+                           SnapshotWriter& out, uint32_t& num_elements ) {
+
+  for (size_t i = 0; i < elements.size(); i++) {
+
+    const SVGElement* element = elements[i];
+    num_elements++;
+
+    SnapshotRecord record;
+    memset( &record, 0, sizeof(record) );
+    record.type = element->type;
+    record.style_id = element->style_id;
+    record.transform_id = element->transform_id;
+    if ( element->style_id == kNotInterned ) record.flags |= kInlineStyle;
+    if ( element->transform_id == kNotInterned ) record.flags |= kInlineTransform;
+
+    switch ( element->type ) {
+      case POLYLINE:
+        record.count = static_cast<const Polyline*>(element)->points.size();
+        break;
+      case POLYGON:
+        record.count = static_cast<const Polygon*>(element)->points.size();
+        break;
+      case IMAGE:
+        record.count = static_cast<const Image*>(element)->tex.mipmap.size();
+        break;
+      case GROUP:
+        record.count = static_cast<const Group*>(element)->elements.size();
+        break;
+      default:
+        break;
+    }
+
+    out.write( &record, sizeof(record) );
+    if ( record.flags & kInlineStyle ) {
+      out.write( &element->style, sizeof(Style) );
+    }
+    if ( record.flags & kInlineTransform ) {
+      out.write( &element->transform, sizeof(Matrix3x3) );
+    }
+    out.align();
+
+    switch ( element->type ) {
+      case POINT: {
+        const Point* point = static_cast<const Point*>(element);
+        out.write( &point->position, sizeof(Vector2D) );
+        break;
+      }
+      case LINE: {
+        const Line* line = static_cast<const Line*>(element);
+        out.write( &line->from, sizeof(Vector2D) );
+        out.write( &line->to,   sizeof(Vector2D) );
+        break;
+      }
+      case POLYLINE: {
+        const Polyline* polyline = static_cast<const Polyline*>(element);
+        if ( record.count ) {
+          out.write( &polyline->points[0], record.count * sizeof(Vector2D) );
+        }
+        break;
+      }
+      case RECT: {
+        const Rect* rect = static_cast<const Rect*>(element);
+        out.write( &rect->position,  sizeof(Vector2D) );
+        out.write( &rect->dimension, sizeof(Vector2D) );
+        break;
+      }
+      case POLYGON: {
+        const Polygon* polygon = static_cast<const Polygon*>(element);
+        if ( record.count ) {
+          out.write( &polygon->points[0], record.count * sizeof(Vector2D) );
+        }
+        break;
+      }
+      case ELLIPSE: {
+        const Ellipse* ellipse = static_cast<const Ellipse*>(element);
+        out.write( &ellipse->center, sizeof(Vector2D) );
+        out.write( &ellipse->radius, sizeof(Vector2D) );
+        break;
+      }
+      case IMAGE: {
+        const Image* image = static_cast<const Image*>(element);
+        out.write( &image->position,  sizeof(Vector2D) );
+        out.write( &image->dimension, sizeof(Vector2D) );
+        uint64_t size[3] = { image->tex.width, image->tex.height,
+                             image->tex.encoded.size() };
+        out.write( size, sizeof(size) );
+        if ( !image->tex.encoded.empty() ) {
+          out.write( &image->tex.encoded[0], image->tex.encoded.size() );
+        }
+        out.align();
+        for (size_t l = 0; l < image->tex.mipmap.size(); l++) {
+          const MipLevel& mip = image->tex.mipmap[l];
+          uint64_t mip_size[2] = { mip.width, mip.height };
+          out.write( mip_size, sizeof(mip_size) );
+          if ( !mip.texels.empty() ) {
+            out.write( &mip.texels[0], mip.texels.size() );
+          }
+          out.align();
+        }
+        break;
+      }
+      case GROUP: {
+        const Group* group = static_cast<const Group*>(element);
+        uint32_t blend = group->blend;
+        out.write( &group->opacity, sizeof(float) );
+        out.write( &blend, sizeof(uint32_t) );
+        save_elements( group->elements, out, num_elements );
+        break;
+      }
+      default:
+        break;
+    }
+  }
+}
+
+static bool load_elements( SnapshotReader& in, uint32_t count, const SVG* svg,
+                           vector<SVGElement*>& elements ) {
+
+  for (uint32_t i = 0; i < count; i++) {
+
+    SnapshotRecord record;
+    if ( !in.read( &record, sizeof(record) ) ) return false;
+
+    SVGElement* element;
+    switch ( record.type ) {
+      case POINT:    element = new Point();    break;
+      case LINE:     element = new Line();     break;
+      case POLYLINE: element = new Polyline(); break;
+      case RECT:     element = new Rect();     break;
+      case POLYGON:  element = new Polygon();  break;
+      case ELLIPSE:  element = new Ellipse();  break;
+      case IMAGE:    element = new Image();    break;
+      case GROUP:    element = new Group();    break;
+      default:       return false;
+    }
+
+    // owned by the caller from here on, so failures below don't leak
+    elements.push_back( element );
+
+    if ( record.flags & kInlineStyle ) {
+      if ( !in.read( &element->style, sizeof(Style) ) ) return false;
+    } else {
+      if ( record.style_id >= svg->styles.size() ) return false;
+      element->style = svg->styles[record.style_id];
+      element->style_id = record.style_id;
+    }
+
+    if ( record.flags & kInlineTransform ) {
+      if ( !in.read( &element->transform, sizeof(Matrix3x3) ) ) return false;
+    } else {
+      if ( record.transform_id >= svg->transforms.size() ) return false;
+      element->transform = svg->transforms[record.transform_id];
+      element->transform_id = record.transform_id;
+    }
+
+    if ( !in.align() ) return false;
+
+    bool ok = true;
+    switch ( record.type ) {
+      case POINT:
+        ok = in.read( &static_cast<Point*>(element)->position, sizeof(Vector2D) );
+        break;
+      case LINE: {
+        Line* line = static_cast<Line*>(element);
+        ok = in.read( &line->from, sizeof(Vector2D) ) &&
+             in.read( &line->to,   sizeof(Vector2D) );
+        break;
+      }
+      case POLYLINE: {
+        vector<Vector2D>& points = static_cast<Polyline*>(element)->points;
+        if ( record.count > (in.size - in.offset) / sizeof(Vector2D) ) return false;
+        points.resize( record.count );
+        if ( record.count ) {
+          ok = in.read( &points[0], record.count * sizeof(Vector2D) );
+        }
+        break;
+      }
+      case RECT: {
+        Rect* rect = static_cast<Rect*>(element);
+        ok = in.read( &rect->position,  sizeof(Vector2D) ) &&
+             in.read( &rect->dimension, sizeof(Vector2D) );
+        break;
+      }
+      case POLYGON: {
+        vector<Vector2D>& points = static_cast<Polygon*>(element)->points;
+        if ( record.count > (in.size - in.offset) / sizeof(Vector2D) ) return false;
+        points.resize( record.count );
+        if ( record.count ) {
+          ok = in.read( &points[0], record.count * sizeof(Vector2D) );
+        }
+        break;
+      }
+      case ELLIPSE: {
+        Ellipse* ellipse = static_cast<Ellipse*>(element);
+        ok = in.read( &ellipse->center, sizeof(Vector2D) ) &&
+             in.read( &ellipse->radius, sizeof(Vector2D) );
+        break;
+      }
+      case IMAGE: {
+        Image* image = static_cast<Image*>(element);
+        uint64_t size[3];
+        ok = in.read( &image->position,  sizeof(Vector2D) ) &&
+             in.read( &image->dimension, sizeof(Vector2D) ) &&
+             in.read( size, sizeof(size) );
+        if ( !ok || record.count > (uint32_t) kMaxMipLevels ) return false;
+        image->tex.width  = size[0];
+        image->tex.height = size[1];
+        if ( size[2] > in.size - in.offset ) return false;
+        image->tex.encoded.resize( size[2] );
+        if ( size[2] && !in.read( &image->tex.encoded[0], size[2] ) ) return false;
+        if ( !in.align() ) return false;
+        image->tex.mipmap.resize( record.count );
+        for (uint32_t l = 0; l < record.count; l++) {
+          MipLevel& mip = image->tex.mipmap[l];
+          uint64_t mip_size[2];
+          if ( !in.read( mip_size, sizeof(mip_size) ) ) return false;
+          if ( mip_size[0] && mip_size[1] > 
+               (in.size - in.offset) / 4 / mip_size[0] ) return false;
+          mip.width  = mip_size[0];
+          mip.height = mip_size[1];
+          mip.texels.resize( 4 * mip.width * mip.height );
+          if ( !mip.texels.empty() &&
+               !in.read( &mip.texels[0], mip.texels.size() ) ) return false;
+          if ( !in.align() ) return false;
+        }
+        break;
+      }
+      case GROUP: {
+        Group* group = static_cast<Group*>(element);
+        uint32_t blend;
+        ok = in.read( &group->opacity, sizeof(float) ) &&
+             in.read( &blend, sizeof(uint32_t) );
+        if ( !ok || blend > BLEND_EXCLUSION ) return false;
+        group->blend = (BlendMode) blend;
+        ok = load_elements( in, record.count, svg, group->elements );
+        break;
+      }
+    }
+    if ( !ok ) return false;
+  }
+
+  return true;
+}
+
+int SVGParser::save( const char* filename, const SVG* svg ) {
+
+  SnapshotWriter out;
+
+  SnapshotHeader header;
+  memset( &header, 0, sizeof(header) );
+  memcpy( header.magic, kSnapshotMagic, sizeof(kSnapshotMagic) );
+  header.version        = kSnapshotVersion;
+  header.byte_order     = kSnapshotByteOrder;
+  header.width          = svg->width;
+  header.height         = svg->height;
+  header.num_styles     = svg->styles.size();
+  header.num_transforms = svg->transforms.size();
+  out.write( &header, sizeof(header) );
+
+  if ( !svg->styles.empty() ) {
+    out.write( &svg->styles[0], svg->styles.size() * sizeof(Style) );
+  }
+  out.align();
+  if ( !svg->transforms.empty() ) {
+    out.write( &svg->transforms[0], svg->transforms.size() * sizeof(Matrix3x3) );
+  }
+
+  // top level element count lives in the first record slot
+  uint32_t num_top = svg->elements.size();
+  out.write( &num_top, sizeof(num_top) );
+  out.align();
+
+  uint32_t num_elements = 0;
+  save_elements( svg->elements, out, num_elements );
+
+  // patch in the total now that it is known
+  SnapshotHeader* h = (SnapshotHeader*) &out.bytes[0];
+  h->num_elements = num_elements;
+
+  ofstream file( filename, ios::out | ios::binary | ios::trunc );
+  if ( !file.is_open() ) return -1;
+  file.write( (const char*) &out.bytes[0], out.bytes.size() );
+  return file.good() ? 0 : -1;
+}
+
+int SVGParser::loadSnapshot( const unsigned char* data, size_t size, SVG* svg ) {
+
+  SnapshotReader in = { data, size, 0 };
+
+  SnapshotHeader header;
+  if ( !in.read( &header, sizeof(header) ) ||
+       memcmp( header.magic, kSnapshotMagic, sizeof(kSnapshotMagic) ) ) {
+    cerr << "Error: not a drawsvg snapshot!" << endl;
+    return -1;
+  }
+  if ( header.version != kSnapshotVersion ||
+       header.byte_order != kSnapshotByteOrder ) {
+    cerr << "Error: unsupported snapshot version " << header.version << endl;
+    return -1;
+  }
+
+  svg->width  = header.width;
+  svg->height = header.height;
+
+  bool ok = header.num_styles <= (size - in.offset) / sizeof(Style);
+  if ( ok ) {
+    svg->styles.resize( header.num_styles );
+    if ( header.num_styles ) {
+      ok = in.read( &svg->styles[0], header.num_styles * sizeof(Style) );
+    }
+  }
+  ok = ok && in.align() &&
+       header.num_transforms <= (size - in.offset) / sizeof(Matrix3x3);
+  if ( ok ) {
+    svg->transforms.resize( header.num_transforms );
+    if ( header.num_transforms ) {
+      ok = in.read( &svg->transforms[0],
+                    header.num_transforms * sizeof(Matrix3x3) );
+    }
+  }
+
+  uint32_t num_top = 0;
+  ok = ok && in.read( &num_top, sizeof(num_top) ) && in.align() &&
+       load_elements( in, num_top, svg, svg->elements );
+
+  if ( !ok ) {
+    cerr << "Error: truncated or corrupt snapshot!" << endl;
+    return -1;
+  }
+
+  computeBounds( svg );
+  computeDetail( svg );
+  return 0;
+}
+
+// Viewport //
+
+// converts an svg length to pixels, percentages are taken of reference
+static float parse_length( const char* str, float reference ) {
+
+  char* unit;
+  float value = strtof( str, &unit );
+  while ( *unit == ' ' ) unit++;
+
+  // absolute units at the css resolution of 96 dpi
+  string u = unit;
+  if ( u == "pt" ) return value * 96.0f / 72.0f;
+  if ( u == "pc" ) return value * 16.0f;
+  if ( u == "in" ) return value * 96.0f;
+  if ( u == "cm" ) return value * 96.0f / 2.54f;
+  if ( u == "mm" ) return value * 96.0f / 25.4f;
+  if ( u == "em" ) return value * 16.0f;
+  if ( u == "ex" ) return value * 8.0f;
+  if ( u == "%"  ) return value * reference / 100.0f;
+  return value;
+}
+
+static inline Vector2D map_point( const Vector2D& p, const Vector2D& scale,
+                                  const Vector2D& offset ) {
+  return Vector2D( p.x * scale.x + offset.x, p.y * scale.y + offset.y );
+}
+
+static inline Vector2D map_size( const Vector2D& d, const Vector2D& scale ) {
+  return Vector2D( d.x * scale.x, d.y * scale.y );
+}
+
+// applies an axis aligned scale + translate to the geometry of elements
+static void normalize_elements( const vector<SVGElement*>& elements,
+                                const Matrix3x3& m, const Matrix3x3& m_inv ) {
+
+  Vector2D scale( m(0,0), m(1,1) );
+  Vector2D offset( m(0,2), m(1,2) );
+
+  for (size_t i = 0; i < elements.size(); i++) {
+
+    SVGElement* element = elements[i];
+
+    // conjugate element transforms so they act in the normalized space
+    const Matrix3x3& t = element->transform;
+    if ( !( t(0,0) == 1 && t(0,1) == 0 && t(0,2) == 0 &&
+            t(1,0) == 0 && t(1,1) == 1 && t(1,2) == 0 ) ) {
+      element->transform = m * t * m_inv;
+    }
+
+    switch ( element->type ) {
+      case POINT: {
+        Point* point = static_cast<Point*>(element);
+        point->position = map_point( point->position, scale, offset );
+        break;
+      }
+      case LINE: {
+        Line* line = static_cast<Line*>(element);
+        line->from = map_point( line->from, scale, offset );
+        line->to   = map_point( line->to, scale, offset );
+        break;
+      }
+      case POLYLINE: {
+        vector<Vector2D>& points = static_cast<Polyline*>(element)->points;
+        for (size_t k = 0; k < points.size(); k++) {
+          points[k] = map_point( points[k], scale, offset );
+        }
+        break;
+      }
+      case RECT: {
+        Rect* rect = static_cast<Rect*>(element);
+        rect->position  = map_point( rect->position, scale, offset );
+        rect->dimension = map_size( rect->dimension, scale );
+        break;
+      }
+      case POLYGON: {
+        vector<Vector2D>& points = static_cast<Polygon*>(element)->points;
+        for (size_t k = 0; k < points.size(); k++) {
+          points[k] = map_point( points[k], scale, offset );
+        }
+        break;
+      }
+      case ELLIPSE: {
+        Ellipse* ellipse = static_cast<Ellipse*>(element);
+        ellipse->center = map_point( ellipse->center, scale, offset );
+        ellipse->radius = map_size( ellipse->radius, scale );
+        break;
+      }
+      case IMAGE: {
+        Image* image = static_cast<Image*>(element);
+        image->position  = map_point( image->position, scale, offset );
+        image->dimension = map_size( image->dimension, scale );
+        break;
+      }
+      case GROUP:
+        normalize_elements( static_cast<Group*>(element)->elements, m, m_inv );
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+void SVGParser::parseViewport( XMLElement* xml, SVG* svg ) {
+
+  // viewBox="min-x min-y width height", separated by spaces and/or commas
+  float vb[4]; bool has_viewbox = false;
+  const char* viewbox = xml->Attribute( "viewBox" );
+  if ( viewbox ) {
+    string vb_str = viewbox;
+    replace( vb_str.begin(), vb_str.end(), ',', ' ' );
+    stringstream ss ( vb_str );
+    has_viewbox = (ss >> vb[0] >> vb[1] >> vb[2] >> vb[3]) &&
+                  vb[2] > 0 && vb[3] > 0;
+  }
+
+  // canvas size in pixels, defaulting to the viewBox size
+  const char* width  = xml->Attribute( "width"  );
+  const char* height = xml->Attribute( "height" );
+  svg->width  = has_viewbox ? vb[2] : 0;
+  svg->height = has_viewbox ? vb[3] : 0;
+  if ( width  ) svg->width  = parse_length( width,  svg->width  );
+  if ( height ) svg->height = parse_length( height, svg->height );
+
+  if ( !has_viewbox || svg->width <= 0 || svg->height <= 0 ) return;
+
+  // preserveAspectRatio="<align> [meet | slice]", default xMidYMid meet
+  string align = "xMidYMid", meet_or_slice = "meet";
+  const char* aspect = xml->Attribute( "preserveAspectRatio" );
+  if ( aspect ) {
+    stringstream ss ( aspect );
+    ss >> align;
+    if ( align == "defer" ) ss >> align;
+    ss >> meet_or_slice;
+  }
+
+  float sx = svg->width  / vb[2];
+  float sy = svg->height / vb[3];
+  float tx = 0, ty = 0;
+  if ( align != "none" ) {
+
+    sx = sy = meet_or_slice == "slice" ? max( sx, sy ) : min( sx, sy );
+
+    // align the scaled viewBox inside the canvas
+    float ax = align.find( "xMid" ) != string::npos ? 0.5f :
+               align.find( "xMax" ) != string::npos ? 1.0f : 0.0f;
+    float ay = align.find( "YMid" ) != string::npos ? 0.5f :
+               align.find( "YMax" ) != string::npos ? 1.0f : 0.0f;
+    tx = ( svg->width  - vb[2] * sx ) * ax;
+    ty = ( svg->height - vb[3] * sy ) * ay;
+  }
+
+  Matrix3x3 m = Matrix3x3::identity();
+  m(0,0) = sx; m(0,2) = tx - vb[0] * sx;
+  m(1,1) = sy; m(1,2) = ty - vb[1] * sy;
+
+  if ( sx == 1 && sy == 1 && m(0,2) == 0 && m(1,2) == 0 ) return;
+
+  // bake the mapping into the geometry once, so renderers work directly
+  // in canvas pixels instead of composing it into every frame
+  normalize_elements( svg->elements, m, m.inv() );
+}
+
 // Parser //
 
 int SVGParser::load( const char* filename, SVG* svg ) {
 
-  ifstream in( filename );
+  ifstream in( filename, ios::binary );
   if( !in.is_open() ) {
      return -1;
   }
+
+  // binary snapshots skip xml parsing entirely
+  char magic[sizeof(kSnapshotMagic)] = { 0 };
+  in.read( magic, sizeof(magic) );
   in.close();
+  if ( memcmp( magic, kSnapshotMagic, sizeof(magic) ) == 0 ) {
+
+#ifndef _WIN32
+    // map the snapshot so the payload is copied out of the page cache once
+    int fd = open( filename, O_RDONLY );
+    if ( fd < 0 ) return -1;
+
+    struct stat st;
+    if ( fstat( fd, &st ) < 0 || st.st_size <= 0 ) { close( fd ); return -1; }
+
+    void* data = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+    if ( data == MAP_FAILED ) return -1;
+
+    int result = loadSnapshot( (const unsigned char*) data, st.st_size, svg );
+    munmap( data, st.st_size );
+    return result;
+#else
+    ifstream file( filename, ios::in | ios::binary | ios::ate );
+    streamsize size = file.tellg();
+    if ( size <= 0 ) return -1;
+
+    vector<unsigned char> data( (size_t) size );
+    file.seekg( 0, ios::beg );
+    file.read( (char*) &data[0], size );
+    return loadSnapshot( &data[0], data.size(), svg );
+#endif
+  }
 
   XMLDocument doc;
   doc.LoadFile( filename );
@@ -47,10 +1051,11 @@ int SVGParser::load( const char* filename, SVG* svg ) {
      exit( 1 );
   }
 
-  root->QueryFloatAttribute( "width",  &svg->width  );
-  root->QueryFloatAttribute( "height", &svg->height );
-
   parseSVG( root, svg );
+  parseViewport( root, svg );
+  intern( svg );
+  computeBounds( svg );
+  computeDetail( svg );
 
   return 0;
 }
@@ -158,6 +1163,9 @@ void SVGParser::parseElement( XMLElement* xml, SVGElement* element ) {
   }
 
 
+  // SVG defaults, so equal styles compare equal when interned
+  style->strokeWidth = 1.0f;
+  style->miterLimit  = 4.0f;
   xml->QueryFloatAttribute( "stroke-width",      &style->strokeWidth );
   xml->QueryFloatAttribute( "stroke-miterlimit", &style->miterLimit  );
 
@@ -348,30 +1356,32 @@ void SVGParser::parseImage( XMLElement* xml, Image* image ) {
   const char* data = xml->Attribute( "xlink:href" );
   while (*data != ',') data++; data++;
   
-  // decode base64 encoded data
-  string encoded = data;
-  encoded.erase(remove(encoded.begin(), encoded.end(), ' ' ), encoded.end());
-  encoded.erase(remove(encoded.begin(), encoded.end(), '\t'), encoded.end());
-  encoded.erase(remove(encoded.begin(), encoded.end(), '\n'), encoded.end());
-  string decoded = base64_decode(encoded);
-
-  // load decoded data into buffer
-  const unsigned char* buffer = (unsigned char*) decoded.c_str(); 
-  size_t size = decoded.size();
-
-  // load into png
-  PNG png; PNGParser::load(buffer, size, png);
-  
-  // create bitmap texture from png (mip level 0)
-  MipLevel mip_start;
-  mip_start.width  = png.width;
-  mip_start.height = png.height;
-  mip_start.texels = png.pixels;
+  // decode base64 encoded data straight from the attribute, the decoder
+  // skips embedded whitespace so no cleaned-up copy is needed
+  size_t length = strlen( data );
+  vector<unsigned char> decoded( base64_decoded_size( length ) );
+  decoded.resize( base64_decode( data, length, &decoded[0] ) );
+
+  // keep the png as is, it is only inflated once the image is visible
+  set_texture_payload( image->tex, decoded );
+}
+
+// a mix-blend-mode value, normal for the ones not supported
+static BlendMode parse_blend_mode( const char* str ) {
+
+  static const char* names[] = {
+    "normal", "multiply", "screen", "overlay", "darken", "lighten",
+    "color-dodge", "color-burn", "hard-light", "soft-light", "difference",
+    "exclusion"
+  };
 
-  // add to svg
-  image->tex.width  = mip_start.width;
-  image->tex.height = mip_start.height;
-  image->tex.mipmap.push_back(mip_start);
+  string mode = str;
+  mode.erase( 0, mode.find_first_not_of( ' ' ) );
+  mode.erase( mode.find_last_not_of( ' ' ) + 1 );
+  for (int i = 0; i <= BLEND_EXCLUSION; i++) {
+    if ( mode == names[i] ) return (BlendMode) i;
+  }
+  return BLEND_NORMAL;
 }
 
 void SVGParser::parseGroup( XMLElement* xml, Group* group ) {
@@ -386,6 +1396,13 @@ void SVGParser::parseGroup( XMLElement* xml, Group* group ) {
    * transformation, and keep in mind that transformation is accumulative.
    * Groups can also be nested.  
    */
+
+  // opacity and blending of the group as a whole
+  xml->QueryFloatAttribute( "opacity", &group->opacity );
+  group->opacity = max( 0.0f, min( group->opacity, 1.0f ) );
+  const char* blend = xml->Attribute( "mix-blend-mode" );
+  if ( blend ) group->blend = parse_blend_mode( blend );
+
   XMLElement* elem = xml->FirstChildElement();
   while( elem ) {
 
@@ -4,6 +4,7 @@
 #include <map>
 #include <vector>
 
+#include "misc.h"
 #include "color.h"
 #include "texture.h"
 #include "vector2D.h"
@@ -14,6 +15,12 @@ using namespace tinyxml2;
 
 namespace CS248 {
 
+// index of elements whose style or transform has not been interned
+static const uint16_t kNotInterned = 0xffff;
+
+// transform table slot reserved for the identity transform
+static const uint16_t kIdentityTransform = 0;
+
 typedef enum e_SVGElementType {
   NONE = 0,
   POINT,
@@ -26,6 +33,86 @@ typedef enum e_SVGElementType {
   GROUP
 } SVGElementType;
 
+// how a group's layer combines with what is drawn below it, the separable
+// modes of mix-blend-mode
+typedef enum e_BlendMode {
+  BLEND_NORMAL = 0,
+  BLEND_MULTIPLY,
+  BLEND_SCREEN,
+  BLEND_OVERLAY,
+  BLEND_DARKEN,
+  BLEND_LIGHTEN,
+  BLEND_COLOR_DODGE,
+  BLEND_COLOR_BURN,
+  BLEND_HARD_LIGHT,
+  BLEND_SOFT_LIGHT,
+  BLEND_DIFFERENCE,
+  BLEND_EXCLUSION
+} BlendMode;
+
+// axis aligned bounds, empty until a point is added
+struct BBox {
+
+  BBox() : min( INF_F, INF_F ), max( -INF_F, -INF_F ) { }
+
+  Vector2D min, max;
+
+  bool empty() const { return min.x > max.x || min.y > max.y; }
+
+  void expand( const Vector2D& p ) {
+    if ( p.x < min.x ) min.x = p.x;
+    if ( p.x > max.x ) max.x = p.x;
+    if ( p.y < min.y ) min.y = p.y;
+    if ( p.y > max.y ) max.y = p.y;
+  }
+
+  void expand( const BBox& b ) {
+    if ( !b.empty() ) { expand( b.min ); expand( b.max ); }
+  }
+
+  bool overlaps( const BBox& b ) const {
+    return min.x <= b.max.x && b.min.x <= max.x &&
+           min.y <= b.max.y && b.min.y <= max.y;
+  }
+
+};
+
+// Uniform grid over the bounds of a list of elements, so that long flat
+// lists can be narrowed down to the elements near a region without
+// scanning all of them. Short lists are left without a grid.
+struct BoundsGrid {
+
+  BoundsGrid() : cols( 0 ), rows( 0 ) { }
+
+  // rebuild over the given bounds, indexed like the element list
+  void build( const std::vector<BBox>& bounds );
+
+  // indices of the elements whose bounds may overlap the region, in list
+  // (painter's) order. Returns false if there is no grid or the region
+  // covers all of it, in which case the caller should scan the list.
+  bool query( const BBox& region, std::vector<uint32_t>& result ) const;
+
+  BBox extent;
+  int cols, rows;
+  Vector2D cell_size;
+
+  // element indices of cell (x,y) are items[start[c]] .. items[start[c+1]]
+  // with c = y * cols + x, in ascending order
+  std::vector<uint32_t> start;
+  std::vector<uint32_t> items;
+
+ private:
+  void cell_range( const BBox& b, int& x0, int& y0, int& x1, int& y1 ) const;
+
+};
+
+// an outline simplified to within tolerance of the original, both in the
+// element's own coordinate space (see computeDetail)
+struct Simplified {
+  float tolerance;
+  std::vector<Vector2D> points;
+};
+
 struct Style {
   Color strokeColor;
   Color fillColor;
@@ -36,7 +123,8 @@ struct Style {
 struct SVGElement {
 
   SVGElement( SVGElementType _type ) 
-    : type( _type ), transform( Matrix3x3::identity() ) { }
+    : type( _type ), style_id( kNotInterned ), transform_id( kNotInterned ),
+      transform( Matrix3x3::identity() ) { }
 
   virtual ~SVGElement() { }
 
@@ -46,6 +134,12 @@ struct SVGElement {
   // styling
   Style style;
 
+  // indices into the owning svg's style and transform tables. These sit in
+  // what used to be alignment padding before the transform, so the element
+  // layout seen by the prebuilt reference renderer is unchanged.
+  uint16_t style_id;
+  uint16_t transform_id;
+
   // transformation list
   Matrix3x3 transform;
   
@@ -53,9 +147,20 @@ struct SVGElement {
 
 struct Group : SVGElement {
 
-  Group() : SVGElement  ( GROUP ) { }
+  Group() : SVGElement  ( GROUP ), opacity( 1 ), blend( BLEND_NORMAL ) { }
   std::vector<SVGElement*> elements;
 
+  // bounds of each element in the group's coordinate space (see computeBounds)
+  std::vector<BBox> bounds;
+  BoundsGrid grid;
+
+  // the group is drawn into a layer of its own and composited with these
+  // unless they are the defaults (see layered)
+  float opacity;
+  BlendMode blend;
+
+  bool layered() const { return opacity < 1 || blend != BLEND_NORMAL; }
+
   ~Group();
 
 };
@@ -80,6 +185,9 @@ struct Polyline : SVGElement {
   Polyline() : SVGElement  ( POLYLINE ) { }
   std::vector<Vector2D> points;
 
+  // coarser copies of points, finest first
+  std::vector<Simplified> detail;
+
 };
 
 struct Rect : SVGElement {
@@ -95,6 +203,9 @@ struct Polygon : SVGElement {
   Polygon() : SVGElement  ( POLYGON ) { }
   std::vector<Vector2D> points;
 
+  // coarser copies of points, finest first
+  std::vector<Simplified> detail;
+
 };
 
 struct Ellipse : SVGElement {
@@ -120,19 +231,45 @@ struct SVG {
   float width, height;
   std::vector<SVGElement*> elements;
 
+  // distinct styles and transforms referenced by elements (see intern)
+  std::vector<Style> styles;
+  std::vector<Matrix3x3> transforms;
+
+  // bounds of each element in canvas space (see computeBounds)
+  std::vector<BBox> bounds;
+  BoundsGrid grid;
+
 };
 
 class SVGParser {
  public:
 
+  // load an svg file or a binary snapshot written by save
   static int load( const char* filename, SVG* svg );
+
+  // write a binary snapshot of a parsed svg (decoded textures included)
   static int save( const char* filename, const SVG* svg );
  
  private:
+
+  // rebuild an svg from an in-memory binary snapshot
+  static int loadSnapshot( const unsigned char* data, size_t size, SVG* svg );
   
   // parse a svg file
   static void parseSVG       ( XMLElement* xml, SVG* svg );
 
+  // parse canvas size and map the viewBox onto it
+  static void parseViewport  ( XMLElement* xml, SVG* svg );
+
+  // share identical styles and transforms between elements
+  static void intern         ( SVG* svg );
+
+  // compute element bounds of the svg and all its groups
+  static void computeBounds  ( SVG* svg );
+
+  // build simplified outlines of dense polylines and polygons
+  static void computeDetail  ( SVG* svg );
+
   // parse shared properties of svg elements
   static void parseElement   ( XMLElement* xml, SVGElement* element );
   
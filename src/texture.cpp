@@ -1,5 +1,6 @@
 #include "texture.h"
 #include "color.h"
+#include "png.h"
 
 #include <assert.h>
 #include <iostream>
@@ -25,6 +26,47 @@ inline void float_to_uint8( unsigned char* dst, float src[4] ) {
   dst_uint8[3] = (uint8_t) ( 255.f * max( 0.0f, min( 1.0f, src[3])));
 }
 
+void set_texture_payload( Texture& tex, vector<unsigned char>& png ) {
+
+  tex.encoded.swap( png );
+
+  // the dimensions are in the IHDR chunk, right after the signature
+  const unsigned char* p = tex.encoded.size() >= 24 ? &tex.encoded[16] : NULL;
+  tex.width  = p ? (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3] : 0;
+  tex.height = p ? (p[4] << 24) | (p[5] << 16) | (p[6] << 8) | p[7] : 0;
+
+  // transparent placeholder until decoded
+  tex.mipmap.assign( 1, MipLevel() );
+  tex.mipmap[0].width  = 1;
+  tex.mipmap[0].height = 1;
+  tex.mipmap[0].texels.assign( 4, 0 );
+}
+
+bool decode_texture( Texture& tex ) {
+
+  if ( tex.encoded.empty() ) return true;
+
+  PNG png;
+  int error = PNGParser::load( &tex.encoded[0], tex.encoded.size(), png );
+
+  // drop the payload either way, a broken image keeps its placeholder
+  vector<unsigned char>().swap( tex.encoded );
+  if ( error ) {
+    std::cerr << "Error: could not decode image (" << error << ")" << std::endl;
+    return false;
+  }
+
+  tex.mipmap.assign( 1, MipLevel() );
+  MipLevel& mip_start = tex.mipmap[0];
+  mip_start.width  = png.width;
+  mip_start.height = png.height;
+  mip_start.texels.swap( png.pixels );
+
+  tex.width  = mip_start.width;
+  tex.height = mip_start.height;
+  return true;
+}
+
 void Sampler2DImp::generate_mips(Texture& tex, int startLevel) {
 
   // NOTE: 
@@ -90,8 +132,8 @@ Color Sampler2DImp::sample_nearest(Texture& tex,
   size_t level_height = tex.mipmap[level].height;
 
   // Find adjusted vector for loc in texture map
-  int u_near = u * level_width;
-  int v_near = v * level_height;
+  int u_near = min(max((int)(u * level_width),  0), (int)level_width  - 1);
+  int v_near = min(max((int)(v * level_height), 0), (int)level_height - 1);
   
   // Access color values inside of map that correlate to nearest pixel
   uint8_t sample_r = tex.mipmap[level].texels[4 * (u_near + v_near * level_width)];
@@ -154,6 +196,18 @@ Color Sampler2DImp::sample_bilinear(Texture& tex,
     pixel_right_bot_y = v_trunc + 0.5;
   }
 
+  // Keep the footprint inside the texture at the borders
+  float max_x = level_width - 1;
+  float max_y = level_height - 1;
+  pixel_left_top_x  = min(max(pixel_left_top_x,  0.0f), max_x);
+  pixel_left_bot_x  = min(max(pixel_left_bot_x,  0.0f), max_x);
+  pixel_right_top_x = min(max(pixel_right_top_x, 0.0f), max_x);
+  pixel_right_bot_x = min(max(pixel_right_bot_x, 0.0f), max_x);
+  pixel_left_top_y  = min(max(pixel_left_top_y,  0.0f), max_y);
+  pixel_left_bot_y  = min(max(pixel_left_bot_y,  0.0f), max_y);
+  pixel_right_top_y = min(max(pixel_right_top_y, 0.0f), max_y);
+  pixel_right_bot_y = min(max(pixel_right_bot_y, 0.0f), max_y);
+
   // Find first interpolation (between bottom two points in x)
   // Values must be pulled from one-dimensional vector that contains all texture
   float left_mid_dist = u_exact - pixel_left_bot_x;
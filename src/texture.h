@@ -24,8 +24,18 @@ struct Texture {
   size_t width;
   size_t height;
   std::vector<MipLevel> mipmap;
+
+  // png payload of a texture that has not been decoded yet. Until it is,
+  // the mipmap holds a single transparent texel so samplers stay safe.
+  std::vector<unsigned char> encoded;
 };
 
+// hold on to a png payload (taken from png) and defer decoding it
+void set_texture_payload( Texture& tex, std::vector<unsigned char>& png );
+
+// decode a pending payload into mip level 0, returns false on failure
+bool decode_texture( Texture& tex );
+
 class Sampler2D {
  public:
 
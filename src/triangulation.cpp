@@ -70,8 +70,11 @@ bool snip(const vector<Vector2D>& contour,int u,int v,int w,int n,int *V ) {
 }
 
 void triangulate(const Polygon& polygon, vector<Vector2D>& triangles) {
-  
-  const vector<Vector2D>& contour = polygon.points;
+
+  triangulate(polygon.points, triangles);
+}
+
+void triangulate(const vector<Vector2D>& contour, vector<Vector2D>& triangles) {
 
   // allocate and initialize list of vertices in polygon
   int n = contour.size();
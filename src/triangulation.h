@@ -8,6 +8,9 @@ namespace CS248 {
 // triangulates a polygon and save the result as a triangle list
 void triangulate(const Polygon& polygon, std::vector<Vector2D>& triangles );
 
+// same for a polygon given by its contour only
+void triangulate(const std::vector<Vector2D>& contour, std::vector<Vector2D>& triangles );
+
 } // namespace CS248
 
 #endif // CS248_TRIANGULATION_H